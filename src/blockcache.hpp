@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Read-ahead block cache for archive reads.
+// Kept free of Windows headers so it can be driven by any file reader, the IAT glue lives in readahead.hpp.
+namespace BlockCache
+{
+    class Source
+    {
+    public:
+        virtual ~Source() = default;
+
+        // Reads up to size bytes at offset. Returns the number of bytes read, 0 at end of file or -1 on failure.
+        virtual std::int64_t Read(std::uint64_t offset, void* buffer, std::size_t size) = 0;
+    };
+
+    struct Config
+    {
+        std::size_t blockSize = 1024 * 1024;
+        std::size_t budget = 256 * 1024 * 1024;
+        unsigned int prefetchBlocks = 4;
+    };
+
+    struct Stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t bytesServed = 0;
+        std::uint64_t blocksPrefetched = 0;
+        std::uint64_t blocksEvicted = 0;
+        std::uint64_t prefetchFailures = 0;
+    };
+
+    struct Range
+    {
+        std::uint64_t offset;
+        std::size_t size;
+    };
+
+    // Follows one stream of reads and predicts the ranges it will read next.
+    class AccessPattern
+    {
+    public:
+        std::vector<Range> Observe(std::uint64_t offset, std::size_t size, const Config& config)
+        {
+            std::vector<Range> predictions;
+
+            if (m_hasLast)
+            {
+                std::int64_t delta = static_cast<std::int64_t>(offset - m_lastOffset);
+                if (offset == m_lastOffset + m_lastSize)
+                {
+                    m_confidence = m_sequential ? m_confidence + 1 : 1;
+                    m_sequential = true;
+                }
+                else if (delta != 0 && delta == m_stride)
+                {
+                    m_confidence = m_sequential ? 1 : m_confidence + 1;
+                    m_sequential = false;
+                }
+                else
+                {
+                    m_confidence = 0;
+                    m_sequential = false;
+                }
+                m_stride = delta;
+            }
+
+            m_hasLast = true;
+            m_lastOffset = offset;
+            m_lastSize = size;
+
+            // Two matching steps in a row before spending I/O on a guess.
+            if (m_confidence < 2)
+                return predictions;
+
+            if (m_sequential)
+            {
+                predictions.push_back({ offset + size, config.blockSize * config.prefetchBlocks });
+            }
+            else
+            {
+                for (unsigned int i = 1; i <= config.prefetchBlocks; ++i)
+                {
+                    std::int64_t next = static_cast<std::int64_t>(offset) + m_stride * static_cast<std::int64_t>(i);
+                    if (next < 0)
+                        break;
+                    predictions.push_back({ static_cast<std::uint64_t>(next), size });
+                }
+            }
+
+            return predictions;
+        }
+
+    private:
+        bool m_hasLast = false;
+        bool m_sequential = false;
+        unsigned int m_confidence = 0;
+        std::uint64_t m_lastOffset = 0;
+        std::size_t m_lastSize = 0;
+        std::int64_t m_stride = 0;
+    };
+
+    class Cache
+    {
+    public:
+        explicit Cache(const Config& config) : m_config(config)
+        {
+            m_worker = std::thread([this] { Worker(); });
+        }
+
+        ~Cache()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+            }
+            m_wake.notify_all();
+            if (m_worker.joinable())
+                m_worker.join();
+        }
+
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        const Config& GetConfig() const { return m_config; }
+
+        std::uint32_t AddFile(std::shared_ptr<Source> source)
+        {
+            std::lock_guard lock(m_mutex);
+            m_sources.push_back(std::move(source));
+            return static_cast<std::uint32_t>(m_sources.size() - 1);
+        }
+
+        // Copies [offset, offset + size) out of the cache if every block it touches is resident.
+        // Returns the number of bytes copied, which is short only at end of file.
+        std::optional<std::size_t> Read(std::uint32_t file, std::uint64_t offset, void* buffer, std::size_t size)
+        {
+            if (size == 0)
+                return 0;
+
+            std::lock_guard lock(m_mutex);
+
+            const auto first = offset / m_config.blockSize;
+            const auto last = (offset + size - 1) / m_config.blockSize;
+
+            std::vector<Block*> blocks;
+            for (auto index = first; index <= last; ++index)
+            {
+                auto it = m_blocks.find(Key(file, index));
+                if (it == m_blocks.end())
+                {
+                    m_stats.misses++;
+                    return std::nullopt;
+                }
+                blocks.push_back(&it->second);
+
+                // A short block is the end of the file, nothing past it can be read anyway.
+                if (it->second.data.size() < m_config.blockSize)
+                    break;
+            }
+
+            std::size_t copied = 0;
+            auto* out = static_cast<std::uint8_t*>(buffer);
+            for (auto* block : blocks)
+            {
+                std::uint64_t blockStart = block->index * m_config.blockSize;
+                std::uint64_t from = std::max<std::uint64_t>(offset + copied, blockStart) - blockStart;
+                if (from >= block->data.size())
+                    break;
+
+                std::size_t count = std::min<std::size_t>(block->data.size() - static_cast<std::size_t>(from), size - copied);
+                std::memcpy(out + copied, block->data.data() + from, count);
+                copied += count;
+
+                m_lru.splice(m_lru.begin(), m_lru, block->lru);
+            }
+
+            m_stats.hits++;
+            m_stats.bytesServed += copied;
+            return copied;
+        }
+
+        // Queues every block covering [offset, offset + size) that isn't resident or already being read.
+        void Prefetch(std::uint32_t file, std::uint64_t offset, std::size_t size)
+        {
+            if (size == 0)
+                return;
+
+            bool queued = false;
+            {
+                std::lock_guard lock(m_mutex);
+                const auto first = offset / m_config.blockSize;
+                const auto last = (offset + size - 1) / m_config.blockSize;
+
+                for (auto index = first; index <= last && m_queue.size() < kMaxQueued; ++index)
+                {
+                    auto key = Key(file, index);
+                    if (m_blocks.contains(key) || m_inFlight.contains(key))
+                        continue;
+
+                    m_inFlight.insert(key);
+                    m_queue.push_back(key);
+                    queued = true;
+                }
+            }
+
+            if (queued)
+                m_wake.notify_one();
+        }
+
+        Stats GetStats()
+        {
+            std::lock_guard lock(m_mutex);
+            return m_stats;
+        }
+
+    private:
+        static constexpr std::size_t kMaxQueued = 256;
+
+        struct Block
+        {
+            std::uint64_t index;
+            std::vector<std::uint8_t> data;
+            std::list<std::uint64_t>::iterator lru;
+        };
+
+        static std::uint64_t Key(std::uint32_t file, std::uint64_t index)
+        {
+            return (static_cast<std::uint64_t>(file) << 40) | index;
+        }
+
+        void Worker()
+        {
+            std::unique_lock lock(m_mutex);
+            while (true)
+            {
+                m_wake.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+                if (m_stopping)
+                    return;
+
+                auto key = m_queue.front();
+                m_queue.pop_front();
+
+                auto file = static_cast<std::uint32_t>(key >> 40);
+                auto index = key & ((1ull << 40) - 1);
+                auto source = m_sources[file];
+
+                lock.unlock();
+                std::vector<std::uint8_t> data(m_config.blockSize);
+                auto bytesRead = source->Read(index * m_config.blockSize, data.data(), data.size());
+                lock.lock();
+
+                m_inFlight.erase(key);
+                if (bytesRead <= 0)
+                {
+                    if (bytesRead < 0)
+                        m_stats.prefetchFailures++;
+                    continue;
+                }
+
+                data.resize(static_cast<std::size_t>(bytesRead));
+                m_used += data.size();
+                m_lru.push_front(key);
+                m_blocks[key] = { index, std::move(data), m_lru.begin() };
+                m_stats.blocksPrefetched++;
+
+                while (m_used > m_config.budget && m_lru.size() > 1)
+                {
+                    auto victim = m_blocks.find(m_lru.back());
+                    m_used -= victim->second.data.size();
+                    m_blocks.erase(victim);
+                    m_lru.pop_back();
+                    m_stats.blocksEvicted++;
+                }
+            }
+        }
+
+        Config m_config;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::thread m_worker;
+        bool m_stopping = false;
+
+        std::vector<std::shared_ptr<Source>> m_sources;
+        std::unordered_map<std::uint64_t, Block> m_blocks;
+        std::list<std::uint64_t> m_lru;
+        std::unordered_set<std::uint64_t> m_inFlight;
+        std::deque<std::uint64_t> m_queue;
+        std::size_t m_used = 0;
+        Stats m_stats;
+    };
+}
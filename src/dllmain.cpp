@@ -6,7 +6,15 @@
 #include <inipp/inipp.h>
 #include <safetyhook.hpp>
 
-#define spdlog_confparse(var) spdlog::info("Config Parse: {}: {}", #var, var)
+#include "leanhook.hpp"
+#include "iotrace.hpp"
+#include "readahead.hpp"
+#include "scalableheap.hpp"
+#include "framepacing.hpp"
+#include "frametime.hpp"
+#include "memorysampler.hpp"
+
+#define config_entry(var) std::pair<std::string, std::string>{ #var, std::format("{}", var) }
 
 HMODULE exeModule = GetModuleHandle(NULL);
 HMODULE thisModule;
@@ -23,20 +31,43 @@ std::string sConfigFile = sFixName + ".ini";
 // Logger
 std::shared_ptr<spdlog::logger> logger;
 std::string sLogFile = sFixName + ".log";
+std::string sSignaturePackFile = sFixName + ".sigpack";
 std::filesystem::path sExePath;
 std::string sExeName;
 
 // Ini variables
 bool bIntroSkip;
 int iShadowResolution;
+int iShadowResolutionMedium = 1024;
+int iShadowResolutionLow = 512;
+bool bShadowResolutionAuto;
 bool bShadowDrawDistance;
+float fShadowDistanceScale = 1.0f;
 bool bAdjustLOD;
 bool bDisableBarsCutscene;
 bool bDisableBarsGlobal;
+bool bSceneProfiler;
+bool bIOTrace;
+int iIOTraceFlushInterval = 1000;
+bool bReadAhead;
+std::string sReadAheadExtensions = ".par";
+int iReadAheadBlockSize = 1024;
+int iReadAheadBlocks = 4;
+int iReadAheadCacheSize = 256;
+bool bReadAheadVerify;
+bool bScalableHeap;
+int iScalableHeapArenaSize = 4096;
+bool bFramePacing;
+int iFramePacingSpinTime = 1000;
+bool bFrameTimeCapture;
+int iFrameTimeSummaryInterval = 60;
+bool bFrameTimeCSV;
+bool bMemorySampler;
+int iMemorySamplerInterval = 10;
 
 // Variables
-int iCurrentResX;
-int iCurrentResY;
+std::atomic<int> iCurrentResX;
+std::atomic<int> iCurrentResY;
 
 // Game info
 struct GameInfo
@@ -115,6 +146,41 @@ void Logging()
     }
 }
 
+// Parsed ini values, logged at startup and stamped on profiling output
+std::vector<std::pair<std::string, std::string>> ActiveSettings()
+{
+    return {
+        config_entry(bIntroSkip),
+        config_entry(iShadowResolution),
+        config_entry(iShadowResolutionMedium),
+        config_entry(iShadowResolutionLow),
+        config_entry(bShadowResolutionAuto),
+        config_entry(bShadowDrawDistance),
+        config_entry(fShadowDistanceScale),
+        config_entry(bAdjustLOD),
+        config_entry(bDisableBarsCutscene),
+        config_entry(bDisableBarsGlobal),
+        config_entry(bSceneProfiler),
+        config_entry(bIOTrace),
+        config_entry(iIOTraceFlushInterval),
+        config_entry(bReadAhead),
+        config_entry(sReadAheadExtensions),
+        config_entry(iReadAheadBlockSize),
+        config_entry(iReadAheadBlocks),
+        config_entry(iReadAheadCacheSize),
+        config_entry(bReadAheadVerify),
+        config_entry(bScalableHeap),
+        config_entry(iScalableHeapArenaSize),
+        config_entry(bFramePacing),
+        config_entry(iFramePacingSpinTime),
+        config_entry(bFrameTimeCapture),
+        config_entry(iFrameTimeSummaryInterval),
+        config_entry(bFrameTimeCSV),
+        config_entry(bMemorySampler),
+        config_entry(iMemorySamplerInterval)
+    };
+}
+
 void Configuration()
 {
     // Inipp initialisation
@@ -144,21 +210,50 @@ void Configuration()
     // Load settings from ini
     inipp::get_value(ini.sections["Intro Skip"], "Enabled", bIntroSkip);
     inipp::get_value(ini.sections["Shadow Quality"], "Resolution", iShadowResolution);
+    inipp::get_value(ini.sections["Shadow Quality"], "MediumResolution", iShadowResolutionMedium);
+    inipp::get_value(ini.sections["Shadow Quality"], "LowResolution", iShadowResolutionLow);
+    inipp::get_value(ini.sections["Shadow Quality"], "Auto", bShadowResolutionAuto);
     inipp::get_value(ini.sections["Shadow Quality"], "DrawDistance", bShadowDrawDistance);
+    inipp::get_value(ini.sections["Shadow Quality"], "DrawDistanceScale", fShadowDistanceScale);
     inipp::get_value(ini.sections["Adjust LOD"], "Enabled", bAdjustLOD);
     inipp::get_value(ini.sections["Disable Pillarboxing"], "CutscenesOnly", bDisableBarsCutscene);
     inipp::get_value(ini.sections["Disable Pillarboxing"], "AllScenes", bDisableBarsGlobal);
+    inipp::get_value(ini.sections["Scene Profiler"], "Enabled", bSceneProfiler);
+    inipp::get_value(ini.sections["IO Trace"], "Enabled", bIOTrace);
+    inipp::get_value(ini.sections["IO Trace"], "FlushInterval", iIOTraceFlushInterval);
+    inipp::get_value(ini.sections["Read Ahead"], "Enabled", bReadAhead);
+    inipp::get_value(ini.sections["Read Ahead"], "Extensions", sReadAheadExtensions);
+    inipp::get_value(ini.sections["Read Ahead"], "BlockSize", iReadAheadBlockSize);
+    inipp::get_value(ini.sections["Read Ahead"], "PrefetchBlocks", iReadAheadBlocks);
+    inipp::get_value(ini.sections["Read Ahead"], "CacheSize", iReadAheadCacheSize);
+    inipp::get_value(ini.sections["Read Ahead"], "Verify", bReadAheadVerify);
+    inipp::get_value(ini.sections["Scalable Heap"], "Enabled", bScalableHeap);
+    inipp::get_value(ini.sections["Scalable Heap"], "ArenaSize", iScalableHeapArenaSize);
+    inipp::get_value(ini.sections["Frame Pacing"], "Enabled", bFramePacing);
+    inipp::get_value(ini.sections["Frame Pacing"], "SpinTime", iFramePacingSpinTime);
+    inipp::get_value(ini.sections["Frame Time Capture"], "Enabled", bFrameTimeCapture);
+    inipp::get_value(ini.sections["Frame Time Capture"], "SummaryInterval", iFrameTimeSummaryInterval);
+    inipp::get_value(ini.sections["Frame Time Capture"], "PerFrameCSV", bFrameTimeCSV);
+    inipp::get_value(ini.sections["Memory Sampler"], "Enabled", bMemorySampler);
+    inipp::get_value(ini.sections["Memory Sampler"], "Interval", iMemorySamplerInterval);
 
     // Clamp settings
     iShadowResolution = std::clamp(iShadowResolution, 64, 8192);
+    iShadowResolutionMedium = std::clamp(iShadowResolutionMedium, 64, 8192);
+    iShadowResolutionLow = std::clamp(iShadowResolutionLow, 64, 8192);
+    fShadowDistanceScale = std::clamp(fShadowDistanceScale, 0.5f, 3.0f);
+    iIOTraceFlushInterval = std::clamp(iIOTraceFlushInterval, 100, 60000);
+    iReadAheadBlockSize = std::clamp(iReadAheadBlockSize, 64, 16384);
+    iReadAheadBlocks = std::clamp(iReadAheadBlocks, 1, 64);
+    iReadAheadCacheSize = std::clamp(iReadAheadCacheSize, 16, 4096);
+    iScalableHeapArenaSize = std::clamp(iScalableHeapArenaSize, 256, 65536);
+    iFramePacingSpinTime = std::clamp(iFramePacingSpinTime, 0, 4000);
+    iFrameTimeSummaryInterval = std::clamp(iFrameTimeSummaryInterval, 5, 3600);
+    iMemorySamplerInterval = std::clamp(iMemorySamplerInterval, 1, 3600);
 
     // Log ini parse
-    spdlog_confparse(bIntroSkip);
-    spdlog_confparse(iShadowResolution);
-    spdlog_confparse(bShadowDrawDistance);
-    spdlog_confparse(bAdjustLOD);
-    spdlog_confparse(bDisableBarsCutscene);
-    spdlog_confparse(bDisableBarsGlobal);
+    for (const auto& [name, value] : ActiveSettings())
+        spdlog::info("Config Parse: {}: {}", name, value);
 
     spdlog::info("----------");
 }
@@ -225,91 +320,6 @@ void IntroSkip()
             }
         }
     
-        if (eGameType != Game::Elvis && eGameType != Game::Sparrow) 
-        {
-            // create_config_scene
-            std::vector<const char*> CreateConfigScenePatterns = {
-                "?? 8B ?? 8B ?? 4C 8B ?? 8B ?? E8 ?? ?? ?? ?? 84 C0 75 ?? 45 33 ?? 45 89 ?? ?? E9 ?? ?? ?? ?? B9 ?? ?? ?? ?? E8 ?? ?? ?? ??",   // Yakuza 6/Kiwami 2
-                "49 8B ?? 8B ?? 4C 8B ?? 8B ?? E8 ?? ?? ?? ?? 84 ?? 75 ?? 33 ?? 41 ?? ?? E9 ?? ?? ?? ??",                                       // Lost Judgment/Gaiden
-                "8B ?? 4C ?? ?? 85 ?? 0F 84 ?? ?? ?? ?? B9 ?? ?? 00 00 E8 ?? ?? ?? ?? 48 8B ?? 48 85 ??"                                        // LAD7/Judgment
-            };
-    
-            std::uint8_t* CreateConfigSceneScanResult = Memory::MultiPatternScan(exeModule, CreateConfigScenePatterns);
-            if (CreateConfigSceneScanResult)
-            {
-                spdlog::info("Intro Skip: Create Config Scene: Address: {:s}+0x{:x}", sExeName, CreateConfigSceneScanResult - (std::uint8_t*)exeModule);
-                static SafetyHookMid CreateConfigSceneMidHook{};
-                CreateConfigSceneMidHook = safetyhook::create_mid(CreateConfigSceneScanResult,
-                    [](SafetyHookContext &ctx)
-                    {
-                        if (ctx.rbx && ctx.r8 && ctx.rdi && !bHasSkippedIntro)
-                        {
-                            if (eGameType == Game::OgreF)
-                                sSceneID = *reinterpret_cast<char**>(ctx.rdi + 0x10);
-                            else if (eGameType == Game::Lexus2)
-                                sSceneID = *reinterpret_cast<char**>(ctx.rbx + 0x08);
-                            else
-                                sSceneID = *reinterpret_cast<char**>(ctx.rbx + 0x10);
-    
-                            iStageID = *reinterpret_cast<int*>(ctx.r8 + 0x4);                      
-                            spdlog::info("Intro Skip: Scene ID = {} (0x{:x}) | Stage: {:x}", sSceneID, ctx.rdx, iStageID);
-                            
-                            // Lost Judgment
-                            if (eGameType == Game::Coyote && Util::string_cmp_caseless(sSceneID, sCoyoteSkipID))
-                            {
-                                ctx.rdx = 0x10D4; // Set to coyote_title
-                                *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xF4; // Stage change!
-                                bHasSkippedIntro = true;
-                            }
-
-                            // Yakuza: Like a Dragon
-                            if (eGameType == Game::Yazawa && Util::string_cmp_caseless(sSceneID, sYazawaSkipID))
-                            {
-                                ctx.rdx = 0x2096; // Set ID to "yazawa_title"
-                                *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xCF; // Stage change!
-                                bHasSkippedIntro = true;
-                            }
-
-                            // Like a Dragon: Gaiden
-                            if (eGameType == Game::Aston && Util::string_cmp_caseless(sSceneID, sAstonSkipID)) 
-                            {
-                                ctx.rdx = 0x177; // Set id to "aston_title"
-                                *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xF4; // Stage change!
-                                bHasSkippedIntro = true;
-                            } 
-                            
-                            // Judgment
-                            if (eGameType == Game::Judge && Util::string_cmp_caseless(sSceneID, sJudgeSkipID)) 
-                            {
-                                ctx.rdx = 0xC88; // Set id to "judge_title"
-                                bHasSkippedIntro = true;
-                            }
-    
-                            // Yakuza 6
-                            if (eGameType == Game::OgreF && Util::string_cmp_caseless(sSceneID, sOgreFSkipID))
-                            {
-                                ctx.rdx = 0x62E; // Set id to "title"
-                                bHasSkippedIntro = true;
-                            }
-
-                            // Yakuza Kiwami 2
-                            if (eGameType == Game::Lexus2 && Util::string_cmp_caseless(sSceneID, sLexus2SkipID)) 
-                            {
-                                ctx.rdx = 0xE10; // Set id to "lexus2_title"
-                                bHasSkippedIntro = true;
-                            }
-
-                            if (bHasSkippedIntro)
-                                spdlog::info("Intro Skip: Skipped intro logos.");
-                        }
-                    });
-            }
-            else
-            {
-                spdlog::error("Intro Skip: Pattern scan(s) failed.");
-            }
-        }
-    
         if (eGameType != Game::Aston && eGameType != Game::Coyote) 
         {
             // Press any key delay
@@ -339,6 +349,185 @@ void IntroSkip()
     }
 }
 
+struct SceneTransition
+{
+    std::string SceneID;
+    uintptr_t SceneIndex;
+    int StageID;
+    std::chrono::steady_clock::time_point Start;
+};
+
+std::mutex sceneProfilerMutex;
+std::ofstream sceneProfilerFile;
+std::chrono::steady_clock::time_point sceneProfilerStart;
+std::optional<SceneTransition> lastSceneTransition;
+unsigned int iSceneTransitionCount = 0;
+
+// Writes the row for the scene that ends at "end". Needs sceneProfilerMutex.
+void WriteSceneRow(std::chrono::steady_clock::time_point end)
+{
+    if (!lastSceneTransition || !sceneProfilerFile.is_open())
+        return;
+
+    double startMs = std::chrono::duration<double, std::milli>(lastSceneTransition->Start - sceneProfilerStart).count();
+    double durationMs = std::chrono::duration<double, std::milli>(end - lastSceneTransition->Start).count();
+    sceneProfilerFile << std::format("{},{},0x{:x},0x{:x},{:.3f},{:.3f}\n", iSceneTransitionCount++, lastSceneTransition->SceneID, lastSceneTransition->SceneIndex, lastSceneTransition->StageID, startMs, durationMs);
+    sceneProfilerFile.flush();
+    lastSceneTransition.reset();
+}
+
+void ProfileSceneTransition(const std::string& sceneID, uintptr_t sceneIndex, int stageID)
+{
+    std::lock_guard lock(sceneProfilerMutex);
+    auto now = std::chrono::steady_clock::now();
+
+    if (!sceneProfilerFile.is_open())
+    {
+        auto sFileName = sFixName + "_Scenes_" + Util::session_timestamp() + ".csv";
+
+        sceneProfilerFile.open(sExePath / sFileName);
+        if (!sceneProfilerFile)
+        {
+            spdlog::error("Scene Profiler: Failed to create {}", sFileName);
+            bSceneProfiler = false;
+            return;
+        }
+
+        spdlog::info("Scene Profiler: Writing scene timeline to {}", sFileName);
+        sceneProfilerFile << "index,scene_id,scene_index,stage_id,start_ms,duration_ms\n";
+        sceneProfilerStart = now;
+    }
+
+    // There is no scene-ready signature yet, so a scene lasts until the next scene or stage is created.
+    WriteSceneRow(now);
+    lastSceneTransition = SceneTransition{ sceneID, sceneIndex, stageID, now };
+}
+
+// The scene on screen at exit has no next transition to close it, so it ends with the process.
+void FlushSceneProfiler()
+{
+    // Threads that were killed on exit may still own the mutex, skip the row rather than hang the exit.
+    std::unique_lock lock(sceneProfilerMutex, std::try_to_lock);
+    if (lock)
+        WriteSceneRow(std::chrono::steady_clock::now());
+}
+
+void ConfigScene()
+{
+    if (!bIntroSkip && !bSceneProfiler && !bMemorySampler)
+        return;
+
+    if (eGameType == Game::Elvis || eGameType == Game::Sparrow)
+    {
+        if (bSceneProfiler)
+            spdlog::info("Scene Profiler: Unsupported game for this feature.");
+        if (bMemorySampler)
+            spdlog::info("Memory Sampler: Scene transitions aren't supported in this game, sampling on the interval only.");
+        return;
+    }
+
+    // create_config_scene
+    std::vector<const char*> CreateConfigScenePatterns = {
+        "?? 8B ?? 8B ?? 4C 8B ?? 8B ?? E8 ?? ?? ?? ?? 84 C0 75 ?? 45 33 ?? 45 89 ?? ?? E9 ?? ?? ?? ?? B9 ?? ?? ?? ?? E8 ?? ?? ?? ??",   // Yakuza 6/Kiwami 2
+        "49 8B ?? 8B ?? 4C 8B ?? 8B ?? E8 ?? ?? ?? ?? 84 ?? 75 ?? 33 ?? 41 ?? ?? E9 ?? ?? ?? ??",                                       // Lost Judgment/Gaiden
+        "8B ?? 4C ?? ?? 85 ?? 0F 84 ?? ?? ?? ?? B9 ?? ?? 00 00 E8 ?? ?? ?? ?? 48 8B ?? 48 85 ??"                                        // LAD7/Judgment
+    };
+
+    std::uint8_t* CreateConfigSceneScanResult = Memory::MultiPatternScan(exeModule, CreateConfigScenePatterns);
+    if (CreateConfigSceneScanResult)
+    {
+        spdlog::info("Create Config Scene: Address: {:s}+0x{:x}", sExeName, CreateConfigSceneScanResult - (std::uint8_t*)exeModule);
+        static SafetyHookMid CreateConfigSceneMidHook{};
+        CreateConfigSceneMidHook = safetyhook::create_mid(CreateConfigSceneScanResult,
+            [](SafetyHookContext &ctx)
+            {
+                if (!ctx.rbx || !ctx.r8 || !ctx.rdi)
+                    return;
+
+                if (bIntroSkip && !bHasSkippedIntro)
+                {
+                    if (eGameType == Game::OgreF)
+                        sSceneID = *reinterpret_cast<char**>(ctx.rdi + 0x10);
+                    else if (eGameType == Game::Lexus2)
+                        sSceneID = *reinterpret_cast<char**>(ctx.rbx + 0x08);
+                    else
+                        sSceneID = *reinterpret_cast<char**>(ctx.rbx + 0x10);
+
+                    iStageID = *reinterpret_cast<int*>(ctx.r8 + 0x4);                      
+                    spdlog::info("Intro Skip: Scene ID = {} (0x{:x}) | Stage: {:x}", sSceneID, ctx.rdx, iStageID);
+                    
+                    // Lost Judgment
+                    if (eGameType == Game::Coyote && Util::string_cmp_caseless(sSceneID, sCoyoteSkipID))
+                    {
+                        ctx.rdx = 0x10D4; // Set to coyote_title
+                        *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xF4; // Stage change!
+                        bHasSkippedIntro = true;
+                    }
+
+                    // Yakuza: Like a Dragon
+                    if (eGameType == Game::Yazawa && Util::string_cmp_caseless(sSceneID, sYazawaSkipID))
+                    {
+                        ctx.rdx = 0x2096; // Set ID to "yazawa_title"
+                        *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xCF; // Stage change!
+                        bHasSkippedIntro = true;
+                    }
+
+                    // Like a Dragon: Gaiden
+                    if (eGameType == Game::Aston && Util::string_cmp_caseless(sSceneID, sAstonSkipID)) 
+                    {
+                        ctx.rdx = 0x177; // Set id to "aston_title"
+                        *reinterpret_cast<int*>(ctx.r8 + 0x4) = 0xF4; // Stage change!
+                        bHasSkippedIntro = true;
+                    } 
+                    
+                    // Judgment
+                    if (eGameType == Game::Judge && Util::string_cmp_caseless(sSceneID, sJudgeSkipID)) 
+                    {
+                        ctx.rdx = 0xC88; // Set id to "judge_title"
+                        bHasSkippedIntro = true;
+                    }
+
+                    // Yakuza 6
+                    if (eGameType == Game::OgreF && Util::string_cmp_caseless(sSceneID, sOgreFSkipID))
+                    {
+                        ctx.rdx = 0x62E; // Set id to "title"
+                        bHasSkippedIntro = true;
+                    }
+
+                    // Yakuza Kiwami 2
+                    if (eGameType == Game::Lexus2 && Util::string_cmp_caseless(sSceneID, sLexus2SkipID)) 
+                    {
+                        ctx.rdx = 0xE10; // Set id to "lexus2_title"
+                        bHasSkippedIntro = true;
+                    }
+
+                    if (bHasSkippedIntro)
+                        spdlog::info("Intro Skip: Skipped intro logos.");
+                }
+
+                if (bSceneProfiler || bMemorySampler)
+                {
+                    const char* sceneID = nullptr;
+                    if (eGameType == Game::OgreF)
+                        sceneID = *reinterpret_cast<char**>(ctx.rdi + 0x10);
+                    else if (eGameType == Game::Lexus2)
+                        sceneID = *reinterpret_cast<char**>(ctx.rbx + 0x08);
+                    else
+                        sceneID = *reinterpret_cast<char**>(ctx.rbx + 0x10);
+
+                    if (bSceneProfiler)
+                        ProfileSceneTransition(sceneID ? sceneID : "", ctx.rdx, *reinterpret_cast<int*>(ctx.r8 + 0x4));
+                    if (bMemorySampler)
+                        MemorySampler::OnSceneTransition(sceneID ? sceneID : "");
+                }
+            });
+    }
+    else
+    {
+        spdlog::error("Create Config Scene: Pattern scan(s) failed.");
+    }
+}
+
 void DisablePillarboxing()
 {
     if (bDisableBarsGlobal) 
@@ -392,9 +581,9 @@ void DisablePillarboxing()
             if (TitleCardsScanResult)
             {
                 spdlog::info("Disable Pillarboxing: Title Cards: Address: {:s}+0x{:x}", sExeName, TitleCardsScanResult - (std::uint8_t*)exeModule);
-                static SafetyHookMid TitleCardsMidHook{};
-                TitleCardsMidHook = safetyhook::create_mid(TitleCardsScanResult + 0x24,
-                    [](SafetyHookContext &ctx)
+                static LeanHook::MidHook TitleCardsMidHook{};
+                TitleCardsMidHook = LeanHook::CreateMid<LeanHook::Rbx | LeanHook::Rflags>(TitleCardsScanResult + 0x24,
+                    [](LeanHook::Context &ctx)
                     {
                         if (ctx.rbx)
                         {
@@ -431,9 +620,9 @@ void DisablePillarboxing()
             if (TitleCardsScanResult)
             {
                 spdlog::info("Disable Pillarboxing: Title Cards: Address: {:s}+0x{:x}", sExeName, TitleCardsScanResult - (std::uint8_t*)exeModule);
-                static SafetyHookMid TitleCardsMidHook{};
-                TitleCardsMidHook = safetyhook::create_mid(TitleCardsScanResult + 0x23,
-                    [](SafetyHookContext &ctx)
+                static LeanHook::MidHook TitleCardsMidHook{};
+                TitleCardsMidHook = LeanHook::CreateMid<LeanHook::Rbx | LeanHook::Rflags>(TitleCardsScanResult + 0x23,
+                    [](LeanHook::Context &ctx)
                     {
                         if (ctx.rbx)
                         {
@@ -455,7 +644,7 @@ void DisablePillarboxing()
             if (CutsceneBarsScanResult) 
             {
                 spdlog::info("Disable Pillarboxing/Letterboxing: Cutscene: Address: {:s}+0x{:x}", sExeName, CutsceneBarsScanResult - (std::uint8_t*)exeModule);
-                Memory::PatchBytes(CutsceneBarsScanResult + 0x3, "\x84", 1);
+                Memory::PatchBytes(CutsceneBarsScanResult + 0x3, "\x84", 1, CutsceneBarsScanResult + 0x2);
             }
             else 
             {
@@ -483,7 +672,7 @@ void DisablePillarboxing()
             if (CutsceneBarsScanResult) 
             {
                 spdlog::info("Disable Pillarboxing/Letterboxing: Cutscene: Address: {:s}+0x{:x}", sExeName, CutsceneBarsScanResult - (std::uint8_t*)exeModule);
-                Memory::PatchBytes(CutsceneBarsScanResult + 0x6, "\x00", 1);
+                Memory::PatchBytes(CutsceneBarsScanResult + 0x6, "\x00", 1, CutsceneBarsScanResult + 0x5);
             }
             else 
             {
@@ -497,7 +686,7 @@ void DisablePillarboxing()
             if (CutsceneBarsScanResult) 
             {
                 spdlog::info("Disable Pillarboxing/Letterboxing: Cutscene: Address: {:s}+0x{:x}", sExeName, CutsceneBarsScanResult - (std::uint8_t*)exeModule);
-                Memory::PatchBytes(CutsceneBarsScanResult + 0x5, "\x00", 1);
+                Memory::PatchBytes(CutsceneBarsScanResult + 0x5, "\x00", 1, CutsceneBarsScanResult + 0x4);
             }
             else 
             {
@@ -511,9 +700,9 @@ void DisablePillarboxing()
             if (CutsceneBarsScanResult) 
             {
                 spdlog::info("Disable Pillarboxing/Letterboxing: Cutscene: Address: {:s}+0x{:x}", sExeName, CutsceneBarsScanResult - (std::uint8_t*)exeModule);
-                static SafetyHookMid CutsceneBarsMidHook{};
-                CutsceneBarsMidHook = safetyhook::create_mid(CutsceneBarsScanResult,
-                    [](SafetyHookContext &ctx)
+                static LeanHook::MidHook CutsceneBarsMidHook{};
+                CutsceneBarsMidHook = LeanHook::CreateMid<LeanHook::Xmm2>(CutsceneBarsScanResult,
+                    [](LeanHook::Context &ctx)
                     {
                         ctx.xmm2.f32[0] = 1000.00f;
                     });
@@ -545,9 +734,222 @@ void DisablePillarboxing()
     }
 }
 
+// Stock shadow map resolution of each engine shadow quality tier
+const int iStockShadowResolutionHigh   = 2048;
+const int iStockShadowResolutionMedium = 1024;
+const int iStockShadowResolutionLow    = 512;
+
+HWND hGameWindow = nullptr;
+
+BOOL CALLBACK FindGameWindowProc(HWND hWnd, LPARAM lParam)
+{
+    DWORD processID = 0;
+    GetWindowThreadProcessId(hWnd, &processID);
+    if (processID != GetCurrentProcessId() || !IsWindowVisible(hWnd) || GetWindow(hWnd, GW_OWNER))
+        return TRUE;
+
+    *reinterpret_cast<HWND*>(lParam) = hWnd;
+    return FALSE;
+}
+
+void UpdateCurrentResolution()
+{
+    if (!hGameWindow || !IsWindow(hGameWindow))
+    {
+        hGameWindow = nullptr;
+        EnumWindows(FindGameWindowProc, reinterpret_cast<LPARAM>(&hGameWindow));
+    }
+
+    // Use the game window's client area, or the primary monitor if the window doesn't exist yet.
+    RECT clientRect{};
+    if (hGameWindow && GetClientRect(hGameWindow, &clientRect) && clientRect.right > 0 && clientRect.bottom > 0)
+    {
+        iCurrentResX = clientRect.right;
+        iCurrentResY = clientRect.bottom;
+    }
+    else
+    {
+        iCurrentResX = GetSystemMetrics(SM_CXSCREEN);
+        iCurrentResY = GetSystemMetrics(SM_CYSCREEN);
+    }
+}
+
+DWORD __stdcall ResolutionWatcherThread(void*)
+{
+    // Keeps the cached output resolution current for auto shadow resolution, so the render thread only reads it.
+    while (true)
+    {
+        Sleep(1000);
+        UpdateCurrentResolution();
+    }
+    return 0;
+}
+
+int AutoShadowResolution()
+{
+    // Roughly two shadow texels per output line, rounded down to a power of two. 1080p = 2048, 2160p = 4096.
+    unsigned int lines = static_cast<unsigned int>(std::max(iCurrentResY.load(std::memory_order_relaxed), 1)) * 2;
+    return std::clamp(static_cast<int>(std::bit_floor(lines)), 1024, 8192);
+}
+
+int ShadowResolutionForTier(int stockResolution)
+{
+    if (bShadowResolutionAuto)
+    {
+        int highResolution = AutoShadowResolution();
+        if (stockResolution == iStockShadowResolutionHigh)
+            return highResolution;
+        if (stockResolution == iStockShadowResolutionMedium)
+            return highResolution / 2;
+        if (stockResolution == iStockShadowResolutionLow)
+            return highResolution / 4;
+    }
+    else
+    {
+        if (stockResolution == iStockShadowResolutionHigh)
+            return iShadowResolution;
+        if (stockResolution == iStockShadowResolutionMedium)
+            return iShadowResolutionMedium;
+        if (stockResolution == iStockShadowResolutionLow)
+            return iShadowResolutionLow;
+    }
+
+    return stockResolution;
+}
+
+std::uint8_t* ShadowDrawDistanceScan()
+{
+    std::uint8_t* ShadowDrawDistanceScanResult = nullptr;
+
+    if (eGameType == Game::Sparrow)
+    {
+        // Pirate: Shadow draw distance
+        ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? 10 ?? ?? ?? ?? ?? C5 ?? ?? ?? 48 8D ?? ?? ?? 49 ?? ?? C5 ?? 11 ?? ?? ??");
+    }
+    else if (eGameType == Game::Elvis || eGameType == Game::Aston || eGameType == Game::Coyote)
+    {
+        // IW/Gaiden/LJ: Shadow draw distance
+        ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? 57 ?? C4 ?? ?? ?? ?? C5 ?? ?? ?? C5 ?? 57 ?? C5 ?? 10 ??");
+    }
+    else if (eGameType == Game::Yazawa || eGameType == Game::Judge) 
+    {
+        // LAD7/Judgment: Shadow draw distance
+        ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? ?? ?? C5 ?? 57 ?? C5 ?? 10 ?? C5 ?? ?? ?? C5 ?? ?? ?? ?? ?? ?? ?? C5 ?? 10 ?? ?? ??");
+    }
+    else if (eGameType == Game::Lexus2 || eGameType == Game::OgreF)
+    {
+        spdlog::info("Shadow Draw Distance: Unsupported game for this feature.");
+    }
+
+    return ShadowDrawDistanceScanResult;
+}
+
+int iShadowDistanceRegister = -1;
+
+void ShadowDrawDistanceScale(std::uint8_t* ShadowDrawDistanceScanResult)
+{
+    // The stock path falls through the jump and loads the cascade distance into an xmm register.
+    // The load sits at a fixed offset into each game's signature, the register is scaled straight after it.
+    std::size_t loadOffset = 0;
+    if (eGameType == Game::Sparrow)
+        loadOffset = 0x2;   // C5 ?? 10 ?? ?? ?? ?? ??
+    else if (eGameType == Game::Elvis || eGameType == Game::Aston || eGameType == Game::Coyote)
+        loadOffset = 0x13;  // C5 ?? 10 ??
+    else if (eGameType == Game::Yazawa || eGameType == Game::Judge)
+        loadOffset = 0xA;   // C5 ?? 10 ??
+
+    std::uint8_t* hookAddress = nullptr;
+    if (loadOffset)
+    {
+        std::uint8_t* address = ShadowDrawDistanceScanResult + loadOffset;
+        ZydisDecodedInstruction instruction{};
+        ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT]{};
+        std::size_t length = Memory::DecodeInstruction(address, instruction, operands);
+
+        // Only a load from memory is the stock distance, a register move means the signature matched something else.
+        if (length && (instruction.mnemonic == ZYDIS_MNEMONIC_VMOVSS || instruction.mnemonic == ZYDIS_MNEMONIC_MOVSS) &&
+            operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+            operands[0].reg.value >= ZYDIS_REGISTER_XMM0 && operands[0].reg.value <= ZYDIS_REGISTER_XMM15 &&
+            operands[1].type == ZYDIS_OPERAND_TYPE_MEMORY)
+        {
+            iShadowDistanceRegister = operands[0].reg.value - ZYDIS_REGISTER_XMM0;
+            hookAddress = address + length;
+        }
+    }
+
+    if (hookAddress)
+    {
+        // The hook overwrites whole instructions from the hook address until it has room for a 5 byte jump.
+        std::uint8_t* patchEnd = hookAddress;
+        while (hookAddress && patchEnd < hookAddress + 5)
+        {
+            ZydisDecodedInstruction instruction{};
+            ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT]{};
+            std::size_t length = Memory::DecodeInstruction(patchEnd, instruction, operands);
+            if (!length)
+                hookAddress = nullptr;
+            patchEnd += length;
+        }
+
+        // A branch landing inside the patched bytes would run the hook on the wrong path or land mid-jump.
+        // That includes the jump at the start of the signature, which is the maximum distance path.
+        for (std::uint8_t* address = ShadowDrawDistanceScanResult; hookAddress && address < patchEnd;)
+        {
+            ZydisDecodedInstruction instruction{};
+            ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT]{};
+            std::size_t length = Memory::DecodeInstruction(address, instruction, operands);
+            if (!length)
+            {
+                hookAddress = nullptr;
+                break;
+            }
+
+            if (instruction.meta.branch_type != ZYDIS_BRANCH_TYPE_NONE && operands[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE && operands[0].imm.is_relative)
+            {
+                std::uint8_t* target = address + length + operands[0].imm.value.s;
+                if (target >= hookAddress && target < patchEnd)
+                {
+                    spdlog::error("Shadow Draw Distance: Scale: Branch at {:s}+0x{:x} targets the hook site.", sExeName, address - (std::uint8_t*)exeModule);
+                    return;
+                }
+            }
+
+            address += length;
+        }
+    }
+
+    if (!hookAddress)
+    {
+        spdlog::error("Shadow Draw Distance: Scale: Failed to find the cascade distance load.");
+        return;
+    }
+
+    spdlog::info("Shadow Draw Distance: Scale: Address: {:s}+0x{:x} (xmm{})", sExeName, hookAddress - (std::uint8_t*)exeModule, iShadowDistanceRegister);
+    static LeanHook::MidHook ShadowDrawDistanceScaleMidHook{};
+    ShadowDrawDistanceScaleMidHook = LeanHook::CreateMid(hookAddress,
+        [](LeanHook::Context &ctx)
+        {
+            (&ctx.xmm0)[iShadowDistanceRegister].f32[0] *= fShadowDistanceScale;
+        }, LeanHook::Xmm0 << iShadowDistanceRegister);
+}
+
 void Graphics()
 {
-    if (iShadowResolution != 2048) 
+    if (bShadowResolutionAuto)
+    {
+        UpdateCurrentResolution();
+        spdlog::info("Shadow Resolution: Auto: Output resolution {}x{}, using {} for the \"High\" shadow setting.", iCurrentResX.load(), iCurrentResY.load(), AutoShadowResolution());
+
+        // Yakuza 6 and Kiwami 2 take the resolution as an immediate patched once below, so only the hooked games follow resizes.
+        if (eGameType != Game::OgreF && eGameType != Game::Lexus2)
+        {
+            HANDLE watcherHandle = CreateThread(NULL, 0, ResolutionWatcherThread, 0, NULL, 0);
+            if (watcherHandle)
+                CloseHandle(watcherHandle);
+        }
+    }
+
+    if (bShadowResolutionAuto || iShadowResolution != iStockShadowResolutionHigh || iShadowResolutionMedium != iStockShadowResolutionMedium || iShadowResolutionLow != iStockShadowResolutionLow) 
     {
         if (eGameType == Game::OgreF) 
         {
@@ -556,8 +958,9 @@ void Graphics()
             if (ShadowResolutionScanResult)
             {
                 spdlog::info("Shadow Resolution: Address: {:s}+0x{:x}", sExeName, ShadowResolutionScanResult - (std::uint8_t*)exeModule);
-                Memory::Write(ShadowResolutionScanResult + 0x6, iShadowResolution);
-                Memory::Write(ShadowResolutionScanResult + 0x10, iShadowResolution);
+                // Immediates of two mov [reg+disp32], imm32 at +0x0 and +0xA.
+                Memory::LiveWrite(ShadowResolutionScanResult + 0x6, ShadowResolutionForTier(iStockShadowResolutionHigh), ShadowResolutionScanResult);
+                Memory::LiveWrite(ShadowResolutionScanResult + 0x10, ShadowResolutionForTier(iStockShadowResolutionHigh), ShadowResolutionScanResult + 0xA);
             }
             else
             {
@@ -571,8 +974,11 @@ void Graphics()
             if (ShadowResolutionScanResult)
             {
                 spdlog::info("Shadow Resolution: Address: {:s}+0x{:x}", sExeName, ShadowResolutionScanResult - (std::uint8_t*)exeModule);
-                Memory::Write(ShadowResolutionScanResult + 0x6, iShadowResolution);
-                Memory::Write(ShadowResolutionScanResult + 0xC, iShadowResolution / 2);
+                // Immediates of mov edx, imm32 at +0x5 and mov r8d-r15d, imm32 at +0xA.
+                // The second is a half-size cascade of the first, not a quality tier, so it keeps the stock ratio.
+                int resolution = ShadowResolutionForTier(iStockShadowResolutionHigh);
+                Memory::LiveWrite(ShadowResolutionScanResult + 0x6, resolution, ShadowResolutionScanResult + 0x5);
+                Memory::LiveWrite(ShadowResolutionScanResult + 0xC, resolution / 2, ShadowResolutionScanResult + 0xA);
             }
             else
             {
@@ -586,13 +992,14 @@ void Graphics()
             if (ShadowResolutionScanResult)
             {
                 spdlog::info("Shadow Resolution: Address: {:s}+0x{:x}", sExeName, ShadowResolutionScanResult - (std::uint8_t*)exeModule);
-                static SafetyHookMid ShadowResolutionMidHook{};
-                ShadowResolutionMidHook = safetyhook::create_mid(ShadowResolutionScanResult,
-                    [](SafetyHookContext &ctx)
+                static LeanHook::MidHook ShadowResolutionMidHook{};
+                ShadowResolutionMidHook = LeanHook::CreateMid<LeanHook::Rcx | LeanHook::Rdx>(ShadowResolutionScanResult,
+                    [](LeanHook::Context &ctx)
                     {
-                        // Check if shadowmap resolution is 2048x2048
-                        if (ctx.rcx == 0x800)
-                            ctx.rcx = ctx.rdx = static_cast<uintptr_t>(iShadowResolution);
+                        // Remap the stock shadowmap resolution of each quality tier
+                        int resolution = ShadowResolutionForTier(static_cast<int>(ctx.rcx));
+                        if (resolution != static_cast<int>(ctx.rcx))
+                            ctx.rcx = ctx.rdx = static_cast<uintptr_t>(resolution);
                     });
             }
             else
@@ -602,34 +1009,24 @@ void Graphics()
         }
     }
 
-    if (bShadowDrawDistance) 
+    if (bShadowDrawDistance || fShadowDistanceScale != 1.0f) 
     {
-        std::uint8_t* ShadowDrawDistanceScanResult = nullptr;
-
-        if (eGameType == Game::Sparrow)
-        {
-            // Pirate: Shadow draw distance
-            ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? 10 ?? ?? ?? ?? ?? C5 ?? ?? ?? 48 8D ?? ?? ?? 49 ?? ?? C5 ?? 11 ?? ?? ??");
-        }
-        else if (eGameType == Game::Elvis || eGameType == Game::Aston || eGameType == Game::Coyote)
-        {
-            // IW/Gaiden/LJ: Shadow draw distance
-            ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? 57 ?? C4 ?? ?? ?? ?? C5 ?? ?? ?? C5 ?? 57 ?? C5 ?? 10 ??");
-        }
-        else if (eGameType == Game::Yazawa || eGameType == Game::Judge) 
-        {
-            // LAD7/Judgment: Shadow draw distance
-            ShadowDrawDistanceScanResult = Memory::PatternScan(exeModule, "75 ?? C5 ?? ?? ?? C5 ?? 57 ?? C5 ?? 10 ?? C5 ?? ?? ?? C5 ?? ?? ?? ?? ?? ?? ?? C5 ?? 10 ?? ?? ??");
-        }
-        else if (eGameType == Game::Lexus2 || eGameType == Game::OgreF)
-        {
-            spdlog::info("Shadow Draw Distance: Unsupported game for this feature.");
-        }
+        std::uint8_t* ShadowDrawDistanceScanResult = ShadowDrawDistanceScan();
 
         if (ShadowDrawDistanceScanResult)
         {
             spdlog::info("Shadow Draw Distance: Address: {:s}+0x{:x}", sExeName, ShadowDrawDistanceScanResult - (std::uint8_t*)exeModule);
-            Memory::PatchBytes(ShadowDrawDistanceScanResult, "\xEB", 1);
+            if (bShadowDrawDistance)
+            {
+                // Always take the maximum distance path, which skips the stock cascade distance.
+                if (fShadowDistanceScale != 1.0f)
+                    spdlog::info("Shadow Draw Distance: DrawDistance is enabled, ignoring DrawDistanceScale.");
+                Memory::PatchBytes(ShadowDrawDistanceScanResult, "\xEB", 1);
+            }
+            else
+            {
+                ShadowDrawDistanceScale(ShadowDrawDistanceScanResult);
+            }
         }
         else
         {
@@ -681,6 +1078,137 @@ void Graphics()
     }
 }
 
+void SignaturePack()
+{
+    // Optional, built by tools/sigpack. Without it every signature uses the built-in scan.
+    auto packPath = sFixPath / sSignaturePackFile;
+    if (!std::filesystem::exists(packPath))
+    {
+        spdlog::info("Signature Pack: {} not found, using built-in signatures.", sSignaturePackFile);
+        return;
+    }
+
+    std::string error;
+    if (Memory::LoadSignaturePack(packPath, static_cast<int>(eGameType), error))
+        spdlog::info("Signature Pack: Loaded {} pattern(s) from {}.", Memory::signaturePack.view->PatternCount(), sSignaturePackFile);
+    else
+        spdlog::error("Signature Pack: Failed to load {}: {}. Using built-in signatures.", sSignaturePackFile, error);
+}
+
+void PrefetchScan()
+{
+    // Fault in the executable sections in one batch instead of one page at a time during the first scan.
+    auto prefetch = Memory::PrefetchModule(exeModule);
+    if (prefetch.succeeded)
+        spdlog::info("Pattern Scan: Prefetch: {} resident page(s), prefetched {} page(s) in {} range(s) in {:.2f}ms ({} page fault(s)).", prefetch.residentPages, prefetch.prefetchedPages, prefetch.prefetchedRanges, prefetch.elapsedMs, prefetch.pageFaults);
+    else
+        spdlog::error("Pattern Scan: Prefetch: Failed to prefetch {} page(s).", prefetch.prefetchedPages);
+}
+
+void LogScanStats()
+{
+    const auto& stats = Memory::scanStats;
+    if (stats.scans == 0)
+        return;
+
+    double warmAverageMs = stats.scans > 1 ? (stats.totalScanMs - stats.firstScanMs) / (stats.scans - 1) : 0.0;
+    spdlog::info("Pattern Scan: {} scan(s) took {:.2f}ms with {} page fault(s).", stats.scans, stats.totalScanMs, stats.pageFaults);
+    spdlog::info("Pattern Scan: Cold scan: {:.2f}ms | Warm scan average: {:.2f}ms", stats.firstScanMs, warmAverageMs);
+
+    const auto& pack = Memory::signaturePack;
+    if (pack.view)
+        spdlog::info("Signature Pack: Match pass: {:.2f}ms | {} hit(s), {} skipped as absent from this build, {} fell back to built-in scan.", pack.passMs, pack.hits, pack.skipped, pack.misses);
+
+    const auto& patches = Memory::patchStats;
+    spdlog::info("Live Patch: {} atomic, {} with threads frozen, {} failed.", patches.atomic, patches.frozen, patches.failed);
+    spdlog::info("----------");
+}
+
+void HeapSubstitution()
+{
+    if (!bScalableHeap)
+        return;
+
+    ScalableHeap::Settings settings{};
+    settings.arenaSize = static_cast<std::size_t>(iScalableHeapArenaSize) * 1024 * 1024;
+    ScalableHeap::Install(exeModule, settings);
+}
+
+void PreciseFramePacing()
+{
+    if (!bFramePacing)
+        return;
+
+    FramePacing::Settings settings{};
+    settings.spinTime = std::chrono::microseconds(iFramePacingSpinTime);
+    FramePacing::Install(exeModule, settings);
+}
+
+void IOTracing()
+{
+    if (bIOTrace)
+        IOTrace::Install(exeModule, sExePath / (sFixName + "_IO_" + Util::session_timestamp() + ".csv"), static_cast<DWORD>(iIOTraceFlushInterval));
+}
+
+void ArchiveReadAhead()
+{
+    if (!bReadAhead)
+        return;
+
+    ReadAhead::Settings settings{};
+    settings.cache.blockSize = static_cast<std::size_t>(iReadAheadBlockSize) * 1024;
+    settings.cache.prefetchBlocks = static_cast<unsigned int>(iReadAheadBlocks);
+    settings.cache.budget = static_cast<std::size_t>(iReadAheadCacheSize) * 1024 * 1024;
+    settings.verify = bReadAheadVerify;
+
+    std::stringstream extensions(sReadAheadExtensions);
+    std::string extension;
+    while (std::getline(extensions, extension, ','))
+    {
+        std::erase(extension, ' ');
+        if (!extension.empty())
+            settings.extensions.emplace_back(extension.begin(), extension.end());
+    }
+
+    ReadAhead::Install(exeModule, settings);
+}
+
+void FrameTimeCapture()
+{
+    if (!bFrameTimeCapture)
+        return;
+
+    auto sTimestamp = Util::session_timestamp();
+
+    FrameTime::Settings settings{};
+    settings.summaryPath = sExePath / (sFixName + "_Frametimes_" + sTimestamp + ".csv");
+    if (bFrameTimeCSV)
+        settings.framesPath = sExePath / (sFixName + "_Frames_" + sTimestamp + ".csv");
+    settings.summaryInterval = std::chrono::seconds(iFrameTimeSummaryInterval);
+
+    settings.tags = { { "Game", game->GameTitle }, { sFixName, sFixVersion } };
+    for (auto& setting : ActiveSettings())
+        settings.tags.push_back(std::move(setting));
+
+    FrameTime::Install(settings);
+}
+
+void MemorySampling()
+{
+    if (!bMemorySampler)
+        return;
+
+    MemorySampler::Settings settings{};
+    settings.reportPath = sExePath / (sFixName + "_Memory_" + Util::session_timestamp() + ".csv");
+    settings.interval = std::chrono::seconds(iMemorySamplerInterval);
+
+    settings.tags = { { "Game", game->GameTitle }, { sFixName, sFixVersion } };
+    for (auto& setting : ActiveSettings())
+        settings.tags.push_back(std::move(setting));
+
+    MemorySampler::Install(settings);
+}
+
 std::mutex mainThreadFinishedMutex;
 std::condition_variable mainThreadFinishedVar;
 bool mainThreadFinished = false;
@@ -691,9 +1219,19 @@ DWORD __stdcall Main(void*)
     Configuration();
     if (DetectGame())
     {
+        HeapSubstitution();
+        IOTracing();
+        ArchiveReadAhead();
+        PreciseFramePacing();
+        MemorySampling();
+        SignaturePack();
+        PrefetchScan();
         IntroSkip();
+        ConfigScene();
         DisablePillarboxing();
         Graphics();
+        FrameTimeCapture();
+        LogScanStats();
     }
 
     {
@@ -705,16 +1243,27 @@ DWORD __stdcall Main(void*)
     return true;
 }
 
+// Final writes for the reports that are only complete once the game exits.
+void Shutdown()
+{
+    if (bSceneProfiler)
+        FlushSceneProfiler();
+    if (bMemorySampler)
+        MemorySampler::Shutdown();
+}
+
 std::mutex getCommandLineMutex;
 bool getCommandLineHookCalled = false;
 LPSTR(WINAPI* GetCommandLineA_Fn)();
+LPSTR WINAPI GetCommandLineA_Hook();
+std::vector<Memory::IATHook> getCommandLineHooks = { Memory::MakeIATHook("kernel32.dll", "GetCommandLineA", &GetCommandLineA_Hook, GetCommandLineA_Fn) };
 LPSTR WINAPI GetCommandLineA_Hook()
 {
     std::lock_guard lock(getCommandLineMutex);
     if (!getCommandLineHookCalled)
     {
         getCommandLineHookCalled = true;
-        Memory::HookIAT(exeModule, "kernel32.dll", GetCommandLineA_Hook, GetCommandLineA_Fn);
+        Memory::UnhookIATBatch(getCommandLineHooks);
         if (!mainThreadFinished)
         {
             std::unique_lock finishedLock(mainThreadFinishedMutex);
@@ -738,15 +1287,7 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
             return FALSE;
 
         thisModule = hModule;
-        HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
-        if (kernel32)
-        {
-            GetCommandLineA_Fn = reinterpret_cast<decltype(GetCommandLineA_Fn)>(GetProcAddress(kernel32, "GetCommandLineA"));
-            if (GetCommandLineA_Fn)
-            {
-                Memory::HookIAT(exeModule, "kernel32.dll", GetCommandLineA_Fn, GetCommandLineA_Hook);
-            }
-        }
+        Memory::HookIATBatch(exeModule, getCommandLineHooks);
 
         HANDLE mainHandle = CreateThread(NULL, 0, Main, 0, NULL, 0);
         if (mainHandle)
@@ -756,9 +1297,11 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
         }
         break;
     }
+    case DLL_PROCESS_DETACH:
+        Shutdown();
+        break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
-    case DLL_PROCESS_DETACH:
         break;
     }
     return TRUE;
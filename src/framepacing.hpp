@@ -0,0 +1,356 @@
+#pragma once
+
+#include "stdafx.h"
+#include "helper.hpp"
+
+#include <spdlog/spdlog.h>
+
+// Tighter frame pacing for the game's own frame limiter.
+// The limiter thread is found by watching which thread's short waits run to their timeout once per frame at a
+// steady cadence, then its Sleep, SleepEx and WaitForSingleObject calls are replaced with a high resolution
+// waitable timer that wakes a little early followed by yielding up to the deadline. Every other thread goes
+// straight to the original functions.
+namespace FramePacing
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        std::chrono::microseconds spinTime{ 1000 };
+    };
+
+    // Waits longer than this aren't frame pacing.
+    constexpr DWORD kMaxFrameWait = 100;
+    // A thread needs this many frames inside one calibration window to count as the limiter.
+    constexpr auto kCalibrationWindow = std::chrono::seconds(2);
+    constexpr std::uint32_t kCalibrationFrames = 40;
+    // Frame to frame intervals of the limiter have to be this steady (standard deviation over mean).
+    // Worker and streaming threads wait after a variable amount of work and don't come close.
+    constexpr double kMaxCadenceVariation = 0.25;
+    // A wait that starts this long after the previous one returned follows real work, so it begins a new frame.
+    constexpr auto kFrameWorkGap = std::chrono::microseconds(200);
+    // How late a high resolution timer can wake. Waits shorter than the spin time plus this skip the timer.
+    constexpr auto kTimerSlack = std::chrono::microseconds(500);
+    // Give the limiter role up if its thread goes quiet, the game may have moved it.
+    constexpr auto kLimiterTimeout = std::chrono::seconds(5);
+
+    struct JitterStats
+    {
+        std::uint64_t frames = 0;
+        double intervalSum = 0.0;
+        double intervalSumSq = 0.0;
+        double intervalMin = 0.0;
+        double intervalMax = 0.0;
+        std::uint64_t waits = 0;
+        double oversleepSum = 0.0;
+        double oversleepMax = 0.0;
+    };
+
+    Settings settings;
+
+    std::atomic<DWORD> limiterThread{ 0 };
+    std::atomic<Clock::rep> lastLimiterWait{ 0 };
+
+    // Frames of one candidate thread, split the same way RecordWait does.
+    struct Cadence
+    {
+        Clock::time_point lastWake{};
+        Clock::time_point frameWake{};
+        std::uint32_t frames = 0;
+        double intervalSum = 0.0;
+        double intervalSumSq = 0.0;
+    };
+
+    std::mutex calibrationMutex;
+    Clock::time_point calibrationStart{};
+    std::unordered_map<DWORD, Cadence> calibrationThreads;
+
+    std::mutex statsMutex;
+    JitterStats jitter;
+
+    // Only touched by the limiter thread.
+    Clock::time_point lastWake{};
+    Clock::time_point frameWake{};
+
+    // PreciseWait waits on its timer through WaitForSingleObject_Fn even when only Sleep is hooked.
+    decltype(&Sleep) Sleep_Fn = Sleep;
+    decltype(&SleepEx) SleepEx_Fn = SleepEx;
+    decltype(&WaitForSingleObject) WaitForSingleObject_Fn = WaitForSingleObject;
+
+    // Called after a short wait on a thread that isn't the limiter ran all the way to its timeout.
+    void Calibrate(DWORD threadId, Clock::time_point start, Clock::time_point wake)
+    {
+        using Milliseconds = std::chrono::duration<double, std::milli>;
+
+        std::lock_guard lock(calibrationMutex);
+
+        if (calibrationStart == Clock::time_point{})
+            calibrationStart = start;
+
+        auto& cadence = calibrationThreads[threadId];
+        if (cadence.lastWake != Clock::time_point{} && start - cadence.lastWake > kFrameWorkGap)
+        {
+            if (cadence.frameWake != Clock::time_point{})
+            {
+                double interval = Milliseconds(cadence.lastWake - cadence.frameWake).count();
+                cadence.intervalSum += interval;
+                cadence.intervalSumSq += interval * interval;
+                cadence.frames++;
+            }
+            cadence.frameWake = cadence.lastWake;
+        }
+        cadence.lastWake = wake;
+
+        if (wake - calibrationStart < kCalibrationWindow)
+            return;
+
+        // Steadiest thread that waits once per frame at a plausible frame rate.
+        DWORD best = 0;
+        double bestVariation = kMaxCadenceVariation;
+        double bestInterval = 0.0;
+        for (const auto& [candidate, frames] : calibrationThreads)
+        {
+            if (frames.frames < kCalibrationFrames)
+                continue;
+
+            double mean = frames.intervalSum / frames.frames;
+            double stddev = std::sqrt(std::max(frames.intervalSumSq / frames.frames - mean * mean, 0.0));
+            if (mean <= 0.0 || mean > kMaxFrameWait || stddev / mean >= bestVariation)
+                continue;
+
+            best = candidate;
+            bestVariation = stddev / mean;
+            bestInterval = mean;
+        }
+
+        if (best && limiterThread.load() == 0)
+        {
+            spdlog::info("Frame Pacing: Frame limiter thread is {} ({:.3f}ms frames, {:.1f}% variation).", best, bestInterval, bestVariation * 100.0);
+            lastLimiterWait = wake.time_since_epoch().count();
+            limiterThread = best;
+        }
+
+        calibrationThreads.clear();
+        calibrationStart = wake;
+    }
+
+    enum class WaitRole
+    {
+        Other,
+        Candidate,  // Could be the limiter, passed through and timed for calibration
+        Limiter
+    };
+
+    WaitRole Classify(DWORD dwMilliseconds)
+    {
+        if (dwMilliseconds == 0 || dwMilliseconds > kMaxFrameWait)
+            return WaitRole::Other;
+
+        DWORD limiter = limiterThread.load(std::memory_order_relaxed);
+        if (!limiter)
+            return WaitRole::Candidate;
+        return limiter == GetCurrentThreadId() ? WaitRole::Limiter : WaitRole::Other;
+    }
+
+    HANDLE LimiterTimer()
+    {
+        thread_local HANDLE timer = []
+        {
+            HANDLE handle = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            if (!handle)
+            {
+                spdlog::warn("Frame Pacing: High resolution timers aren't supported, falling back to a regular waitable timer.");
+                handle = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+            }
+            return handle;
+        }();
+        return timer;
+    }
+
+    void RecordWait(Clock::time_point start, Clock::time_point deadline, Clock::time_point wake)
+    {
+        using Milliseconds = std::chrono::duration<double, std::milli>;
+        using Microseconds = std::chrono::duration<double, std::micro>;
+
+        std::lock_guard lock(statsMutex);
+
+        if (lastWake != Clock::time_point{} && start - lastWake > kFrameWorkGap)
+        {
+            // The last wake of the previous frame is where it was released, measure between those.
+            if (frameWake != Clock::time_point{})
+            {
+                double interval = Milliseconds(lastWake - frameWake).count();
+                jitter.intervalMin = jitter.frames ? std::min(jitter.intervalMin, interval) : interval;
+                jitter.intervalMax = std::max(jitter.intervalMax, interval);
+                jitter.intervalSum += interval;
+                jitter.intervalSumSq += interval * interval;
+                jitter.frames++;
+            }
+            frameWake = lastWake;
+        }
+        lastWake = wake;
+
+        double oversleep = Microseconds(wake - deadline).count();
+        jitter.oversleepSum += oversleep;
+        jitter.oversleepMax = std::max(jitter.oversleepMax, oversleep);
+        jitter.waits++;
+    }
+
+    // Waits until now + dwMilliseconds, or until hObject is signalled when one is given.
+    DWORD PreciseWait(HANDLE hObject, DWORD dwMilliseconds)
+    {
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::milliseconds(dwMilliseconds);
+        auto coarseDeadline = deadline - settings.spinTime;
+        lastLimiterWait.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+
+        HANDLE timer = LimiterTimer();
+        if (!timer)
+        {
+            if (hObject)
+                return WaitForSingleObject_Fn(hObject, dwMilliseconds);
+            Sleep_Fn(dwMilliseconds);
+            return 0;
+        }
+
+        // Short waits never touch the timer, its wake-up alone could overshoot the deadline.
+        if (deadline - start > settings.spinTime + kTimerSlack)
+        {
+            LARGE_INTEGER dueTime{};
+            dueTime.QuadPart = -std::chrono::duration_cast<std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>>(coarseDeadline - start).count();
+            SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE);
+
+            if (hObject)
+            {
+                HANDLE handles[] = { hObject, timer };
+                DWORD result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+                if (result != WAIT_OBJECT_0 + 1)
+                {
+                    // The object is first in the list, so its results already read like WaitForSingleObject's.
+                    CancelWaitableTimer(timer);
+                    return result;
+                }
+            }
+            else
+            {
+                WaitForSingleObject_Fn(timer, INFINITE);
+            }
+        }
+
+        while (Clock::now() < deadline)
+        {
+            if (hObject)
+            {
+                DWORD result = WaitForSingleObject_Fn(hObject, 0);
+                if (result != WAIT_TIMEOUT)
+                    return result;
+            }
+
+            // Hand the core to anything else that's ready rather than burning it, only spin when nothing is.
+            if (!SwitchToThread())
+                YieldProcessor();
+        }
+
+        RecordWait(start, deadline, Clock::now());
+        return hObject ? WAIT_TIMEOUT : 0;
+    }
+
+    void WINAPI Sleep_Hook(DWORD dwMilliseconds)
+    {
+        switch (Classify(dwMilliseconds))
+        {
+        case WaitRole::Limiter:
+            PreciseWait(nullptr, dwMilliseconds);
+            break;
+        case WaitRole::Candidate:
+        {
+            auto start = Clock::now();
+            Sleep_Fn(dwMilliseconds);
+            Calibrate(GetCurrentThreadId(), start, Clock::now());
+            break;
+        }
+        default:
+            Sleep_Fn(dwMilliseconds);
+        }
+    }
+
+    DWORD WINAPI SleepEx_Hook(DWORD dwMilliseconds, BOOL bAlertable)
+    {
+        // Alertable sleeps can be cut short by APCs, keep those on the real thing.
+        WaitRole role = bAlertable ? WaitRole::Other : Classify(dwMilliseconds);
+        if (role == WaitRole::Limiter)
+            return PreciseWait(nullptr, dwMilliseconds);
+
+        auto start = Clock::now();
+        DWORD result = SleepEx_Fn(dwMilliseconds, bAlertable);
+        if (role == WaitRole::Candidate)
+            Calibrate(GetCurrentThreadId(), start, Clock::now());
+        return result;
+    }
+
+    DWORD WINAPI WaitForSingleObject_Hook(HANDLE hHandle, DWORD dwMilliseconds)
+    {
+        WaitRole role = Classify(dwMilliseconds);
+        if (role == WaitRole::Limiter)
+            return PreciseWait(hHandle, dwMilliseconds);
+
+        auto start = Clock::now();
+        DWORD result = WaitForSingleObject_Fn(hHandle, dwMilliseconds);
+
+        // Threads woken by their object, like audio or job threads, are driven by someone else and aren't pacing anything.
+        if (role == WaitRole::Candidate && result == WAIT_TIMEOUT)
+            Calibrate(GetCurrentThreadId(), start, Clock::now());
+        return result;
+    }
+
+    // Also notices when the limiter thread stops waiting and hands the role back to calibration.
+    void LogStats()
+    {
+        JitterStats stats{};
+        {
+            std::lock_guard lock(statsMutex);
+            stats = std::exchange(jitter, {});
+        }
+
+        if (stats.frames > 1)
+        {
+            double mean = stats.intervalSum / stats.frames;
+            double stddev = std::sqrt(std::max(stats.intervalSumSq / stats.frames - mean * mean, 0.0));
+            spdlog::info("Frame Pacing: {} frame(s), interval {:.3f}ms avg, {:.3f}ms stddev, {:.3f}ms min, {:.3f}ms max.", stats.frames, mean, stddev, stats.intervalMin, stats.intervalMax);
+            spdlog::info("Frame Pacing: {} wait(s), oversleep {:.1f}us avg, {:.1f}us max.", stats.waits, stats.oversleepSum / stats.waits, stats.oversleepMax);
+        }
+
+        auto lastWait = Clock::time_point(Clock::duration(lastLimiterWait.load()));
+        if (limiterThread.load() && Clock::now() - lastWait > kLimiterTimeout)
+        {
+            spdlog::info("Frame Pacing: Frame limiter thread {} went quiet, recalibrating.", limiterThread.load());
+            {
+                std::lock_guard lock(statsMutex);
+                lastWake = frameWake = Clock::time_point{};
+            }
+            limiterThread = 0;
+        }
+    }
+
+    void Install(HMODULE module, const Settings& pacingSettings)
+    {
+        settings = pacingSettings;
+
+        std::vector<Memory::IATHook> hooks = {
+            Memory::MakeIATHook("kernel32.dll", "Sleep", &Sleep_Hook, Sleep_Fn),
+            Memory::MakeIATHook("kernel32.dll", "SleepEx", &SleepEx_Hook, SleepEx_Fn),
+            Memory::MakeIATHook("kernel32.dll", "WaitForSingleObject", &WaitForSingleObject_Hook, WaitForSingleObject_Fn)
+        };
+        std::size_t hooked = Memory::HookIATBatch(module, hooks);
+        for (const auto& hook : hooks)
+            spdlog::info("Frame Pacing: {}: {}", hook.function, hook.hooked ? "Hooked." : "Not imported.");
+
+        if (!hooked)
+        {
+            spdlog::error("Frame Pacing: None of Sleep/SleepEx/WaitForSingleObject are imported, frame pacing disabled.");
+            return;
+        }
+
+        Util::run_periodically(std::chrono::seconds(10), LogStats);
+    }
+}
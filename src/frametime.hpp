@@ -0,0 +1,352 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include <d3d11.h>
+#include <dxgi1_2.h>
+
+#include <safetyhook.hpp>
+#include <spdlog/spdlog.h>
+
+// Frame time capture for benchmarking tweaks against each other.
+// Present and Present1 are hooked through the vtable of a throwaway swap chain, so the same hook covers every
+// game whether it renders with D3D11 or D3D12. Each present pushes a QPC timestamp into a lock-free ring that a
+// writer thread drains into percentile summaries and, optionally, a per-frame CSV.
+namespace FrameTime
+{
+    struct Settings
+    {
+        std::filesystem::path summaryPath;
+        std::filesystem::path framesPath;
+        std::chrono::seconds summaryInterval{ 60 };
+        std::vector<std::pair<std::string, std::string>> tags;
+    };
+
+    struct Summary
+    {
+        std::size_t frames = 0;
+        double averageMs = 0.0;
+        double maxMs = 0.0;
+        double averageFps = 0.0;
+        double low1Fps = 0.0;
+        double low01Fps = 0.0;
+    };
+
+    // Multi-producer ring of present timestamps. The game presents from one thread at a time, but not necessarily
+    // the same one, so slots are claimed atomically and published through a per-slot sequence.
+    // A slot holding position p reads 2p + 1 while it's being written and 2p + 2 once published, so the consumer
+    // can tell from the slot alone whether it's waiting on a write or has been lapped.
+    class TimestampRing
+    {
+    public:
+        static constexpr std::size_t kCapacity = 1 << 16;
+
+        void Push(std::int64_t timestamp)
+        {
+            std::uint64_t position = m_head.fetch_add(1, std::memory_order_relaxed);
+            auto& slot = m_slots[position & (kCapacity - 1)];
+
+            slot.sequence.store(Writing(position), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.timestamp.store(timestamp, std::memory_order_relaxed);
+            slot.sequence.store(Published(position), std::memory_order_release);
+        }
+
+        // Single consumer. Returns false once the next position isn't published yet, counts slots lost to overruns.
+        bool Pop(std::int64_t& timestamp, std::uint64_t& dropped)
+        {
+            while (true)
+            {
+                auto& slot = m_slots[m_tail & (kCapacity - 1)];
+                std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+                // Not written yet, or its producer is still writing it.
+                if (sequence < Published(m_tail))
+                    return false;
+
+                if (sequence == Published(m_tail))
+                {
+                    timestamp = slot.timestamp.load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+                    {
+                        m_tail++;
+                        return true;
+                    }
+                    continue;
+                }
+
+                // A later lap took the slot. Its position says how far behind we are, so skip to the oldest
+                // position that lap can't have overwritten yet.
+                std::uint64_t lapped = (sequence - 1) / 2;
+                std::uint64_t oldest = lapped - kCapacity + 1;
+                dropped += oldest - m_tail;
+                m_tail = oldest;
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::uint64_t> sequence{ 0 };
+            std::atomic<std::int64_t> timestamp{ 0 };
+        };
+
+        static constexpr std::uint64_t Writing(std::uint64_t position) { return position * 2 + 1; }
+        static constexpr std::uint64_t Published(std::uint64_t position) { return position * 2 + 2; }
+
+        alignas(64) std::atomic<std::uint64_t> m_head{ 0 };
+        alignas(64) std::uint64_t m_tail = 0;
+        std::unique_ptr<Slot[]> m_slots = std::make_unique<Slot[]>(kCapacity);
+    };
+
+    Settings settings;
+    TimestampRing ring;
+    double qpcToMs = 0.0;
+
+    SafetyHookInline PresentHook{};
+    SafetyHookInline Present1Hook{};
+
+    // Present1 may land in Present on some runtimes, only the outermost call is a frame.
+    thread_local int presentDepth = 0;
+
+    void RecordPresent(UINT flags)
+    {
+        if (presentDepth > 1 || (flags & DXGI_PRESENT_TEST))
+            return;
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        ring.Push(now.QuadPart);
+    }
+
+    HRESULT STDMETHODCALLTYPE Present_Hook(IDXGISwapChain* swapChain, UINT syncInterval, UINT flags)
+    {
+        ++presentDepth;
+        RecordPresent(flags);
+        HRESULT result = PresentHook.unsafe_stdcall<HRESULT>(swapChain, syncInterval, flags);
+        --presentDepth;
+        return result;
+    }
+
+    HRESULT STDMETHODCALLTYPE Present1_Hook(IDXGISwapChain1* swapChain, UINT syncInterval, UINT flags, const DXGI_PRESENT_PARAMETERS* parameters)
+    {
+        ++presentDepth;
+        RecordPresent(flags);
+        HRESULT result = Present1Hook.unsafe_stdcall<HRESULT>(swapChain, syncInterval, flags, parameters);
+        --presentDepth;
+        return result;
+    }
+
+    // 1% and 0.1% lows are the frame rate at the 99th and 99.9th percentile frame time.
+    Summary Summarize(std::vector<float> frameTimes)
+    {
+        Summary summary{};
+        summary.frames = frameTimes.size();
+        if (frameTimes.empty())
+            return summary;
+
+        double total = 0.0;
+        for (float frameTime : frameTimes)
+            total += frameTime;
+
+        auto percentile = [&frameTimes](double fraction)
+        {
+            auto nth = frameTimes.begin() + static_cast<std::ptrdiff_t>(fraction * (frameTimes.size() - 1));
+            std::nth_element(frameTimes.begin(), nth, frameTimes.end());
+            return static_cast<double>(*nth);
+        };
+
+        summary.averageMs = total / frameTimes.size();
+        summary.averageFps = 1000.0 / summary.averageMs;
+        summary.low1Fps = 1000.0 / percentile(0.99);
+        summary.low01Fps = 1000.0 / percentile(0.999);
+        summary.maxMs = *std::max_element(frameTimes.begin(), frameTimes.end());
+        return summary;
+    }
+
+    void WriteSummary(std::ofstream& file, const char* scope, double elapsedSeconds, const Summary& summary)
+    {
+        file << std::format("{},{:.1f},{},{:.3f},{:.1f},{:.1f},{:.1f},{:.3f}\n", scope, elapsedSeconds, summary.frames, summary.averageMs, summary.averageFps, summary.low1Fps, summary.low01Fps, summary.maxMs);
+        file.flush();
+    }
+
+    DWORD __stdcall WriterThread(void*)
+    {
+        std::ofstream summaryFile(settings.summaryPath);
+        if (!summaryFile)
+        {
+            spdlog::error("Frame Time Capture: Failed to create {}", settings.summaryPath.filename().string());
+            return 0;
+        }
+
+        for (const auto& [name, value] : settings.tags)
+            summaryFile << "# " << name << " = " << value << "\n";
+        summaryFile << "scope,elapsed_s,frames,avg_ms,avg_fps,1%_low_fps,0.1%_low_fps,max_ms\n";
+        spdlog::info("Frame Time Capture: Writing summaries to {}", settings.summaryPath.filename().string());
+
+        std::ofstream framesFile;
+        if (!settings.framesPath.empty())
+        {
+            framesFile.open(settings.framesPath);
+            if (framesFile)
+            {
+                framesFile << "frame,time_ms,frametime_ms\n";
+                spdlog::info("Frame Time Capture: Writing per-frame times to {}", settings.framesPath.filename().string());
+            }
+            else
+            {
+                spdlog::error("Frame Time Capture: Failed to create {}", settings.framesPath.filename().string());
+            }
+        }
+
+        std::vector<float> window;
+        std::vector<float> session;
+        std::int64_t first = 0;
+        std::int64_t last = 0;
+        std::uint64_t frame = 0;
+        std::uint64_t dropped = 0;
+        std::uint64_t droppedLogged = 0;
+        auto windowStart = std::chrono::steady_clock::now();
+
+        while (true)
+        {
+            Sleep(100);
+
+            std::int64_t timestamp;
+            while (ring.Pop(timestamp, dropped))
+            {
+                if (last)
+                {
+                    float frameTime = static_cast<float>((timestamp - last) * qpcToMs);
+                    window.push_back(frameTime);
+                    session.push_back(frameTime);
+                    if (framesFile)
+                        framesFile << std::format("{},{:.3f},{:.3f}\n", frame++, (timestamp - first) * qpcToMs, frameTime);
+                }
+                else
+                {
+                    first = timestamp;
+                }
+                last = timestamp;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - windowStart < settings.summaryInterval)
+                continue;
+
+            if (framesFile)
+                framesFile.flush();
+
+            double elapsed = last ? (last - first) * qpcToMs / 1000.0 : 0.0;
+            auto windowSummary = Summarize(window);
+            if (windowSummary.frames)
+            {
+                WriteSummary(summaryFile, "window", elapsed, windowSummary);
+                WriteSummary(summaryFile, "session", elapsed, Summarize(session));
+                spdlog::info("Frame Time Capture: {} frame(s), {:.1f} fps avg, {:.1f} fps 1% low, {:.1f} fps 0.1% low, {:.2f}ms max.", windowSummary.frames, windowSummary.averageFps, windowSummary.low1Fps, windowSummary.low01Fps, windowSummary.maxMs);
+            }
+
+            if (dropped != droppedLogged)
+            {
+                spdlog::warn("Frame Time Capture: {} frame(s) dropped by the capture ring.", dropped - droppedLogged);
+                droppedLogged = dropped;
+            }
+
+            window.clear();
+            windowStart = now;
+        }
+        return 0;
+    }
+
+    LRESULT CALLBACK DummyWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+    {
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+    }
+
+    // Creates a hidden window and a D3D11 swap chain just to read the DXGI swap chain vtable.
+    bool FindPresent(void*& present, void*& present1)
+    {
+        WNDCLASSEXW windowClass{ sizeof(WNDCLASSEXW) };
+        windowClass.lpfnWndProc = DummyWindowProc;
+        windowClass.hInstance = GetModuleHandleW(nullptr);
+        windowClass.lpszClassName = L"DragonTweakFrameTime";
+        RegisterClassExW(&windowClass);
+
+        HWND hwnd = CreateWindowExW(0, windowClass.lpszClassName, L"", WS_OVERLAPPEDWINDOW, 0, 0, 64, 64, nullptr, nullptr, windowClass.hInstance, nullptr);
+        if (!hwnd)
+            return false;
+
+        DXGI_SWAP_CHAIN_DESC desc{};
+        desc.BufferCount = 1;
+        desc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+        desc.OutputWindow = hwnd;
+        desc.SampleDesc.Count = 1;
+        desc.Windowed = TRUE;
+        desc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+
+        IDXGISwapChain* swapChain = nullptr;
+        ID3D11Device* device = nullptr;
+        ID3D11DeviceContext* context = nullptr;
+        HRESULT result = D3D11CreateDeviceAndSwapChain(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION, &desc, &swapChain, &device, nullptr, &context);
+        if (SUCCEEDED(result))
+        {
+            auto** vtable = *reinterpret_cast<void***>(swapChain);
+            present = vtable[8];
+
+            IDXGISwapChain1* swapChain1 = nullptr;
+            if (SUCCEEDED(swapChain->QueryInterface(__uuidof(IDXGISwapChain1), reinterpret_cast<void**>(&swapChain1))))
+            {
+                present1 = (*reinterpret_cast<void***>(swapChain1))[22];
+                swapChain1->Release();
+            }
+
+            swapChain->Release();
+            device->Release();
+            context->Release();
+        }
+
+        DestroyWindow(hwnd);
+        UnregisterClassW(windowClass.lpszClassName, windowClass.hInstance);
+        return SUCCEEDED(result);
+    }
+
+    void Install(const Settings& captureSettings)
+    {
+        settings = captureSettings;
+
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        qpcToMs = 1000.0 / static_cast<double>(frequency.QuadPart);
+
+        void* present = nullptr;
+        void* present1 = nullptr;
+        if (!FindPresent(present, present1))
+        {
+            spdlog::error("Frame Time Capture: Failed to create a swap chain to locate Present.");
+            return;
+        }
+
+        // The render thread may already be presenting, and the detours call through these, so both are stored
+        // before either is switched on.
+        PresentHook = safetyhook::create_inline(present, reinterpret_cast<void*>(Present_Hook), SafetyHookInline::StartDisabled);
+        if (present1)
+            Present1Hook = safetyhook::create_inline(present1, reinterpret_cast<void*>(Present1_Hook), SafetyHookInline::StartDisabled);
+
+        if (!PresentHook || !PresentHook.enable())
+        {
+            spdlog::error("Frame Time Capture: Failed to hook Present.");
+            PresentHook = {};
+            Present1Hook = {};
+            return;
+        }
+        if (Present1Hook && !Present1Hook.enable())
+            Present1Hook = {};
+        spdlog::info("Frame Time Capture: Hooked Present{}.", Present1Hook ? " and Present1" : "");
+
+        HANDLE writerHandle = CreateThread(NULL, 0, WriterThread, 0, NULL, 0);
+        if (writerHandle)
+            CloseHandle(writerHandle);
+    }
+}
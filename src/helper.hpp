@@ -1,4 +1,10 @@
+#pragma once
+
 #include "stdafx.h"
+#include "importindex.hpp"
+#include "sigpack.hpp"
+
+#include <Zydis.h>
 
 namespace Memory
 {
@@ -11,14 +17,6 @@ namespace Memory
         VirtualProtect((LPVOID)(writeAddress), sizeof(T), oldProtect, &oldProtect);
     }
 
-    void PatchBytes(std::uint8_t* address, const char* pattern, unsigned int numBytes)
-    {
-        DWORD oldProtect;
-        VirtualProtect((LPVOID)address, numBytes, PAGE_EXECUTE_READWRITE, &oldProtect);
-        memcpy((LPVOID)address, pattern, numBytes);
-        VirtualProtect((LPVOID)address, numBytes, oldProtect, &oldProtect);
-    }
-
     std::vector<int> pattern_to_byte(const char* pattern)
     {
         auto bytes = std::vector<int>{};
@@ -39,32 +37,325 @@ namespace Memory
         return bytes;
     }
 
-    std::uint8_t* PatternScan(void* module, const char* signature) 
+    struct ScanRange
+    {
+        std::uint8_t* start;
+        std::uint8_t* end;      // Last possible match start (exclusive)
+        std::uint8_t* limit;    // End of the section, matches may read up to here
+        bool resident;
+    };
+
+    struct ScanStats
+    {
+        unsigned int scans = 0;
+        double firstScanMs = 0.0;
+        double totalScanMs = 0.0;
+        DWORD pageFaults = 0;
+    } scanStats;
+
+    struct PrefetchStats
+    {
+        std::size_t residentPages = 0;
+        std::size_t prefetchedPages = 0;
+        std::size_t prefetchedRanges = 0;
+        DWORD pageFaults = 0;
+        double elapsedMs = 0.0;
+        bool succeeded = false;
+    };
+
+    DWORD PageFaultCount()
+    {
+        PROCESS_MEMORY_COUNTERS pmc{};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+            return 0;
+        return pmc.PageFaultCount;
+    }
+
+    // Splits the executable (or, with executable = false, every other) section of a module into runs of resident
+    // and non-resident pages.
+    std::vector<ScanRange> GetScanRanges(void* module, bool executable = true)
     {
         auto dosHeader = (PIMAGE_DOS_HEADER)module;
         auto ntHeaders = (PIMAGE_NT_HEADERS)((std::uint8_t*)module + dosHeader->e_lfanew);
+        auto sections = IMAGE_FIRST_SECTION(ntHeaders);
+        auto base = reinterpret_cast<std::uint8_t*>(module);
 
-        auto sizeOfImage = ntHeaders->OptionalHeader.SizeOfImage;
-        auto patternBytes = pattern_to_byte(signature);
-        auto scanBytes = reinterpret_cast<std::uint8_t*>(module);
+        SYSTEM_INFO si{};
+        GetSystemInfo(&si);
+        const std::size_t pageSize = si.dwPageSize;
+
+        std::vector<ScanRange> ranges;
+
+        for (WORD i = 0; i < ntHeaders->FileHeader.NumberOfSections; ++i)
+        {
+            const auto& section = sections[i];
+            if (((section.Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0) != executable)
+                continue;
+
+            // SizeOfRawData is file aligned and can run past the mapping, so it only stands in when VirtualSize is 0.
+            // The tail of the last page is mapped either way, and nothing goes beyond SizeOfImage.
+            auto sectionStart = base + section.VirtualAddress;
+            auto sectionSize = static_cast<std::size_t>(section.Misc.VirtualSize ? section.Misc.VirtualSize : section.SizeOfRawData);
+            sectionSize = (sectionSize + pageSize - 1) / pageSize * pageSize;
+            sectionSize = std::min<std::size_t>(sectionSize, ntHeaders->OptionalHeader.SizeOfImage - std::min(section.VirtualAddress, ntHeaders->OptionalHeader.SizeOfImage));
+            auto sectionEnd = sectionStart + sectionSize;
+            if (sectionSize == 0)
+                continue;
+
+            auto pageCount = (sectionSize + pageSize - 1) / pageSize;
+            std::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages(pageCount);
+            for (std::size_t p = 0; p < pageCount; ++p)
+                pages[p].VirtualAddress = sectionStart + p * pageSize;
+
+            // If residency can't be queried then treat the whole section as a single resident run.
+            if (!QueryWorkingSetEx(GetCurrentProcess(), pages.data(), static_cast<DWORD>(pages.size() * sizeof(pages[0]))))
+            {
+                ranges.push_back({ sectionStart, sectionEnd, sectionEnd, true });
+                continue;
+            }
+
+            for (std::size_t p = 0; p < pageCount; ++p)
+            {
+                bool resident = pages[p].VirtualAttributes.Valid;
+                auto pageStart = sectionStart + p * pageSize;
+                auto pageEnd = std::min(pageStart + pageSize, sectionEnd);
+
+                if (!ranges.empty() && ranges.back().limit == sectionEnd && ranges.back().end == pageStart && ranges.back().resident == resident)
+                    ranges.back().end = pageEnd;
+                else
+                    ranges.push_back({ pageStart, pageEnd, sectionEnd, resident });
+            }
+        }
+
+        return ranges;
+    }
+
+    // Issues a single batched read-ahead for every non-resident page the scanner is going to touch.
+    PrefetchStats PrefetchModule(void* module)
+    {
+        PrefetchStats stats{};
+        DWORD faultsBefore = PageFaultCount();
+        auto startTime = std::chrono::steady_clock::now();
+
+        SYSTEM_INFO si{};
+        GetSystemInfo(&si);
+
+        std::vector<WIN32_MEMORY_RANGE_ENTRY> entries;
+        for (const auto& range : GetScanRanges(module))
+        {
+            std::size_t pages = (static_cast<std::size_t>(range.end - range.start) + si.dwPageSize - 1) / si.dwPageSize;
+            if (range.resident)
+            {
+                stats.residentPages += pages;
+                continue;
+            }
+
+            stats.prefetchedPages += pages;
+            entries.push_back({ range.start, static_cast<SIZE_T>(range.end - range.start) });
+        }
+
+        stats.prefetchedRanges = entries.size();
+        stats.succeeded = entries.empty() || PrefetchVirtualMemory(GetCurrentProcess(), entries.size(), entries.data(), 0);
+
+        stats.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        stats.pageFaults = PageFaultCount() - faultsBefore;
+        return stats;
+    }
+
+    // Section layout doesn't change once a module is loaded, so scans work from ranges computed once per module.
+    // The residency flags in these go stale after the first scan and aren't used for scanning.
+    const std::vector<ScanRange>& CachedScanRanges(void* module, bool executable = true)
+    {
+        static std::mutex cacheMutex;
+        static std::unordered_map<void*, std::vector<ScanRange>> executableRanges;
+        static std::unordered_map<void*, std::vector<ScanRange>> dataRanges;
+
+        std::lock_guard lock(cacheMutex);
+        auto& cache = executable ? executableRanges : dataRanges;
+        auto it = cache.find(module);
+        if (it == cache.end())
+            it = cache.emplace(module, GetScanRanges(module, executable)).first;
+        return it->second;
+    }
+
+    bool MatchAt(const std::uint8_t* address, const int* pattern, std::size_t size)
+    {
+        for (std::size_t j = 0; j < size; ++j) {
+            if (address[j] != pattern[j] && pattern[j] != -1)
+                return false;
+        }
+        return true;
+    }
+
+    void RecordScan(std::chrono::steady_clock::time_point startTime, DWORD faultsBefore)
+    {
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        if (scanStats.scans == 0)
+            scanStats.firstScanMs = elapsedMs;
+        scanStats.scans++;
+        scanStats.totalScanMs += elapsedMs;
+        scanStats.pageFaults += PageFaultCount() - faultsBefore;
+    }
+
+    struct SignaturePackState
+    {
+        std::optional<SigPack::View> view;
+        int game = 0;
+        void* module = nullptr;                                 // Module the matches below belong to
+        std::vector<std::vector<std::uint8_t*>> matches;        // Per pattern record, in address order
+        unsigned int hits = 0;
+        unsigned int skipped = 0;
+        unsigned int misses = 0;
+        double passMs = 0.0;
+    } signaturePack;
+
+    // Maps a precompiled signature pack for the rest of the process' lifetime.
+    bool LoadSignaturePack(const std::filesystem::path& path, int game, std::string& error)
+    {
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            error = std::format("failed to open file (error {})", GetLastError());
+            return false;
+        }
+
+        LARGE_INTEGER size{};
+        GetFileSizeEx(file, &size);
+        HANDLE mapping = size.QuadPart ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+        if (!mapping)
+        {
+            error = "failed to map file";
+            return false;
+        }
 
+        auto data = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (!data)
+        {
+            error = "failed to map file";
+            return false;
+        }
+
+        auto view = SigPack::View::Open(data, static_cast<std::size_t>(size.QuadPart), error);
+        if (!view)
+        {
+            UnmapViewOfFile(data);
+            return false;
+        }
+
+        signaturePack.view = view;
+        signaturePack.game = game;
+        return true;
+    }
+
+    // Looks a built-in signature up in the signature pack.
+    // Returns nothing if the pack has no say, in which case the built-in scan runs as usual. Otherwise returns the
+    // pack's matches, which are empty when the pack marks the signature as absent from this game's build.
+    std::optional<std::vector<std::uint8_t*>> SignaturePackScan(void* module, const char* signature)
+    {
+        auto& pack = signaturePack;
+        if (!pack.view)
+            return std::nullopt;
+
+        auto key = SigPack::Key(signature);
+        if (!key)
+            return std::nullopt;
+
+        // Every pattern in the pack is matched in one pass the first time it's needed.
+        if (!pack.module)
+        {
+            auto startTime = std::chrono::steady_clock::now();
+            pack.module = module;
+            pack.matches.assign(pack.view->PatternCount(), {});
+
+            // Same order as PatternScan: executable sections, then the rest of the image only for patterns that
+            // found nothing in code.
+            std::vector<bool> wanted(pack.view->PatternCount(), true);
+            for (bool executable : { true, false })
+            {
+                for (const auto& range : CachedScanRanges(module, executable))
+                {
+                    pack.view->Match(range.start, range.end, range.limit, pack.game, [&](std::uint32_t index, const std::uint8_t* start)
+                    {
+                        if (wanted[index])
+                            pack.matches[index].push_back(const_cast<std::uint8_t*>(start) + pack.view->Record(index).offset);
+                    });
+                }
+
+                bool needData = false;
+                for (std::uint32_t index = 0; index < pack.view->PatternCount(); ++index)
+                {
+                    wanted[index] = pack.matches[index].empty();
+                    needData = needData || (wanted[index] && !SigPack::View::Absent(pack.view->Record(index)) && SigPack::View::AppliesTo(pack.view->Record(index), pack.game));
+                }
+                if (!needData)
+                    break;
+            }
+            pack.passMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        }
+        if (pack.module != module)
+            return std::nullopt;
+
+        if (auto index = pack.view->Find(*key, pack.game))
+        {
+            if (SigPack::View::Absent(pack.view->Record(*index)))
+            {
+                pack.skipped++;
+                return std::vector<std::uint8_t*>{};
+            }
+
+            // A pack written for an older build may not match anymore, let the built-in pattern have a go.
+            if (pack.matches[*index].empty())
+            {
+                pack.misses++;
+                return std::nullopt;
+            }
+            pack.hits++;
+            return pack.matches[*index];
+        }
+
+        // Entries for other games only, the pack has nothing to say about this one.
+        return std::nullopt;
+    }
+
+    std::uint8_t* PatternScan(void* module, const char* signature) 
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        DWORD faultsBefore = PageFaultCount();
+
+        if (auto packed = SignaturePackScan(module, signature))
+        {
+            RecordScan(startTime, faultsBefore);
+            return packed->empty() ? nullptr : packed->front();
+        }
+
+        auto patternBytes = pattern_to_byte(signature);
         auto s = patternBytes.size();
         auto d = patternBytes.data();
 
-        for (auto i = 0ul; i < sizeOfImage - s; ++i) {
-            bool found = true;
-            for (auto j = 0ul; j < s; ++j) {
-                if (scanBytes[i + j] != d[j] && d[j] != -1) {
-                    found = false;
-                    break;
+        std::uint8_t* result = nullptr;
+
+        // Code signatures are looked for in executable sections first, anything else falls back to the rest of the
+        // image so signatures aimed at .rdata/.data still match. Ranges are in address order, so the first match
+        // is the same one a linear scan of those sections would find.
+        for (bool executable : { true, false }) {
+            for (const auto& range : CachedScanRanges(module, executable)) {
+                for (auto current = range.start; current < range.end && current + s <= range.limit; ++current) {
+                    if (MatchAt(current, d, s)) {
+                        result = current;
+                        break;
+                    }
                 }
+                if (result)
+                    break;
             }
-            if (found) {
-                return &scanBytes[i];
-            }
+            if (result)
+                break;
         }
 
-        return nullptr;
+        RecordScan(startTime, faultsBefore);
+        return result;
     }
 
     std::uint8_t* MultiPatternScan(void* module, const std::vector<const char*>& signatures) 
@@ -80,31 +371,34 @@ namespace Memory
 
     std::vector<std::uint8_t*> PatternScanAll(void* module, const char* signature)
     {
-        auto dosHeader = (PIMAGE_DOS_HEADER)module;
-        auto ntHeaders = (PIMAGE_NT_HEADERS)((std::uint8_t*)module + dosHeader->e_lfanew);
-    
-        auto sizeOfImage = ntHeaders->OptionalHeader.SizeOfImage;
+        auto startTime = std::chrono::steady_clock::now();
+        DWORD faultsBefore = PageFaultCount();
+
+        if (auto packed = SignaturePackScan(module, signature))
+        {
+            RecordScan(startTime, faultsBefore);
+            return *packed;
+        }
+
         auto patternBytes = pattern_to_byte(signature);
-        auto scanBytes = reinterpret_cast<std::uint8_t*>(module);
-    
         auto s = patternBytes.size();
         auto d = patternBytes.data();
     
         std::vector<std::uint8_t*> results;
-    
-        for (auto i = 0ul; i < sizeOfImage - s; ++i) {
-            bool found = true;
-            for (auto j = 0ul; j < s; ++j) {
-                if (scanBytes[i + j] != d[j] && d[j] != -1) {
-                    found = false;
-                    break;
+
+        // Same fallback as PatternScan. Ranges are walked in address order, so results come out sorted.
+        for (bool executable : { true, false }) {
+            for (const auto& range : CachedScanRanges(module, executable)) {
+                for (auto current = range.start; current < range.end && current + s <= range.limit; ++current) {
+                    if (MatchAt(current, d, s))
+                        results.push_back(current);
                 }
             }
-            if (found) {
-                results.push_back(&scanBytes[i]);
-            }
+            if (!results.empty())
+                break;
         }
-    
+
+        RecordScan(startTime, faultsBefore);
         return results;
     }
 
@@ -139,40 +433,436 @@ namespace Memory
         return absoluteAddress;
     }
 
-    BOOL HookIAT(HMODULE callerModule, char const* targetModule, const void* targetFunction, void* detourFunction)
+    // Decodes the instruction at address and returns its length, or 0 if it couldn't be decoded.
+    std::size_t DecodeInstruction(const std::uint8_t* address, ZydisDecodedInstruction& instruction, ZydisDecodedOperand (&operands)[ZYDIS_MAX_OPERAND_COUNT])
+    {
+        ZydisDecoder decoder{};
+        if (!ZYAN_SUCCESS(ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64)))
+            return 0;
+
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder, address, ZYDIS_MAX_INSTRUCTION_LENGTH, &instruction, operands)))
+            return 0;
+
+        return instruction.length;
+    }
+
+    enum class PatchMethod
+    {
+        Failed,
+        Atomic,
+        Frozen
+    };
+
+    struct PatchStats
+    {
+        unsigned int atomic = 0;
+        unsigned int frozen = 0;
+        unsigned int failed = 0;
+    };
+
+    PatchStats patchStats;
+
+    // Offsets of every instruction boundary decoding from code until at least length bytes are covered.
+    // Empty if anything in the way doesn't decode.
+    std::vector<std::size_t> InstructionBoundaries(const std::uint8_t* code, std::size_t length)
+    {
+        ZydisDecodedInstruction instruction{};
+        ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT]{};
+
+        std::vector<std::size_t> boundaries{ 0 };
+        for (std::size_t offset = 0; offset < length;)
+        {
+            std::size_t size = DecodeInstruction(code + offset, instruction, operands);
+            if (!size)
+                return {};
+            offset += size;
+            boundaries.push_back(offset);
+        }
+        return boundaries;
+    }
+
+    // Swaps the patch in with one locked compare-exchange if it sits inside an aligned 8 or 16 byte window.
+    // Other threads fetch either all of the old bytes or all of the new ones, never a mix.
+    bool AtomicPatch(std::uint8_t* address, const std::uint8_t* bytes, std::size_t size)
     {
-        auto* base = (uint8_t*)callerModule;
-        const auto* dos_header = (IMAGE_DOS_HEADER*)base;
-        const auto nt_headers = (IMAGE_NT_HEADERS*)(base + dos_header->e_lfanew);
-        const auto* imports = (IMAGE_IMPORT_DESCRIPTOR*)(base + nt_headers->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress);
+        auto start = reinterpret_cast<std::uintptr_t>(address);
+        auto last = start + size - 1;
+
+        std::size_t windowSize = 0;
+        if ((start & ~std::uintptr_t(7)) == (last & ~std::uintptr_t(7)))
+            windowSize = 8;
+        else if ((start & ~std::uintptr_t(15)) == (last & ~std::uintptr_t(15)))
+            windowSize = 16;
+        else
+            return false;
+
+        auto* window = reinterpret_cast<std::uint8_t*>(start & ~std::uintptr_t(windowSize - 1));
+        const std::size_t offset = address - window;
 
-        for (int i = 0; imports[i].Characteristics; i++)
+        DWORD oldProtect;
+        if (!VirtualProtect(window, windowSize, PAGE_EXECUTE_READWRITE, &oldProtect))
+            return false;
+
+        if (windowSize == 8)
+        {
+            auto* target = reinterpret_cast<volatile LONG64*>(window);
+            LONG64 expected = *target;
+            while (true)
+            {
+                LONG64 desired = expected;
+                std::memcpy(reinterpret_cast<std::uint8_t*>(&desired) + offset, bytes, size);
+
+                LONG64 seen = InterlockedCompareExchange64(target, desired, expected);
+                if (seen == expected)
+                    break;
+                expected = seen;
+            }
+        }
+        else
         {
-            const char* name = (const char*)(base + imports[i].Name);
-            if (lstrcmpiA(name, targetModule) != 0)
+            auto* target = reinterpret_cast<volatile LONG64*>(window);
+            alignas(16) LONG64 expected[2] = { target[0], target[1] };
+            alignas(16) LONG64 desired[2];
+            do
+            {
+                std::memcpy(desired, expected, sizeof(desired));
+                std::memcpy(reinterpret_cast<std::uint8_t*>(desired) + offset, bytes, size);
+            } while (!_InterlockedCompareExchange128(target, desired[1], desired[0], expected));
+        }
+
+        VirtualProtect(window, windowSize, oldProtect, &oldProtect);
+        FlushInstructionCache(GetCurrentProcess(), window, windowSize);
+        return true;
+    }
+
+    // Suspends every other thread and writes the patch once none of them is stopped inside [regionStart, regionEnd)
+    // at an offset that isn't listed in safeOffsets.
+    bool FrozenPatch(std::uint8_t* address, const std::uint8_t* bytes, std::size_t size, std::uint8_t* regionStart, std::size_t regionSize, const std::vector<std::size_t>& safeOffsets)
+    {
+        constexpr int kAttempts = 50;
+
+        std::vector<HANDLE> threads;
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot == INVALID_HANDLE_VALUE)
+            return false;
+
+        THREADENTRY32 entry{};
+        entry.dwSize = sizeof(entry);
+        for (BOOL more = Thread32First(snapshot, &entry); more; more = Thread32Next(snapshot, &entry))
+        {
+            if (entry.th32OwnerProcessID != GetCurrentProcessId() || entry.th32ThreadID == GetCurrentThreadId())
                 continue;
+            if (HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, entry.th32ThreadID))
+                threads.push_back(thread);
+        }
+        CloseHandle(snapshot);
 
-            void** thunk = (void**)(base + imports[i].FirstThunk);
+        // Which threads this attempt actually suspended. Sized up front, a suspended thread could be holding the heap lock.
+        std::vector<std::uint8_t> suspended(threads.size());
 
-            for (; *thunk; thunk++)
+        bool patched = false;
+        for (int attempt = 0; attempt < kAttempts && !patched; ++attempt)
+        {
+            // Nothing below may touch the heap.
+            bool busy = false;
+            std::fill(suspended.begin(), suspended.end(), std::uint8_t(0));
+            for (std::size_t i = 0; i < threads.size() && !busy; ++i)
             {
-                const void* import = *thunk;
-
-                if (import != targetFunction)
+                // Usually a thread that exited since the snapshot, it can't be running the region.
+                if (SuspendThread(threads[i]) == static_cast<DWORD>(-1))
                     continue;
+                suspended[i] = 1;
+
+                // GetThreadContext waits for the suspension to actually take effect. Without a context there's
+                // no telling where the thread stopped, so it counts as busy.
+                CONTEXT context{};
+                context.ContextFlags = CONTEXT_CONTROL;
+                if (!GetThreadContext(threads[i], &context))
+                {
+                    busy = true;
+                    break;
+                }
+
+                auto* ip = reinterpret_cast<std::uint8_t*>(context.Rip);
+                if (ip > regionStart && ip < regionStart + regionSize && !std::binary_search(safeOffsets.begin(), safeOffsets.end(), static_cast<std::size_t>(ip - regionStart)))
+                    busy = true;
+            }
+
+            if (!busy)
+            {
+                DWORD oldProtect;
+                if (VirtualProtect(address, size, PAGE_EXECUTE_READWRITE, &oldProtect))
+                {
+                    std::memcpy(address, bytes, size);
+                    VirtualProtect(address, size, oldProtect, &oldProtect);
+                    FlushInstructionCache(GetCurrentProcess(), address, size);
+                    patched = true;
+                }
+                else
+                {
+                    attempt = kAttempts;
+                }
+            }
+
+            for (std::size_t i = 0; i < threads.size(); ++i)
+            {
+                if (suspended[i])
+                    ResumeThread(threads[i]);
+            }
+
+            if (busy)
+                Sleep(1);
+        }
+
+        for (HANDLE thread : threads)
+            CloseHandle(thread);
+        return patched;
+    }
+
+    // Writes a code patch while the game may be running it.
+    // instruction is the start of the instruction the patch begins in, when the patch doesn't begin on one itself.
+    // If the patch keeps every existing instruction boundary intact and fits an aligned 8 or 16 byte window it is
+    // swapped in atomically, otherwise every other thread is frozen for the write.
+    PatchMethod LivePatch(std::uint8_t* address, const char* pattern, unsigned int numBytes, std::uint8_t* instruction = nullptr)
+    {
+        if (!instruction)
+            instruction = address;
+
+        const auto* bytes = reinterpret_cast<const std::uint8_t*>(pattern);
+        const std::size_t prefix = address - instruction;
+
+        auto oldBoundaries = InstructionBoundaries(instruction, prefix + numBytes);
+        const std::size_t regionSize = oldBoundaries.empty() ? prefix + numBytes : oldBoundaries.back();
+
+        // Decode the patched region with the original bytes after it so the last instruction has its full length.
+        std::vector<std::uint8_t> image(instruction, instruction + regionSize + ZYDIS_MAX_INSTRUCTION_LENGTH);
+        std::copy(bytes, bytes + numBytes, image.begin() + prefix);
+        auto newBoundaries = InstructionBoundaries(image.data(), regionSize);
+
+        bool boundariesKept = !oldBoundaries.empty() && !newBoundaries.empty() && newBoundaries.back() == regionSize &&
+            std::includes(newBoundaries.begin(), newBoundaries.end(), oldBoundaries.begin(), oldBoundaries.end());
+
+        if (boundariesKept && AtomicPatch(address, bytes, numBytes))
+        {
+            patchStats.atomic++;
+            return PatchMethod::Atomic;
+        }
+
+        // A frozen thread can only resume at an old boundary that still starts an instruction afterwards.
+        std::vector<std::size_t> safeOffsets;
+        std::set_intersection(oldBoundaries.begin(), oldBoundaries.end(), newBoundaries.begin(), newBoundaries.end(), std::back_inserter(safeOffsets));
+
+        if (FrozenPatch(address, bytes, numBytes, instruction, regionSize, safeOffsets))
+        {
+            patchStats.frozen++;
+            return PatchMethod::Frozen;
+        }
+
+        patchStats.failed++;
+        return PatchMethod::Failed;
+    }
+
+    void PatchBytes(std::uint8_t* address, const char* pattern, unsigned int numBytes, std::uint8_t* instruction = nullptr)
+    {
+        LivePatch(address, pattern, numBytes, instruction);
+    }
+
+    // Live patches a value inside the instruction that starts at instruction, like an immediate operand.
+    template<typename T>
+    PatchMethod LiveWrite(std::uint8_t* address, T value, std::uint8_t* instruction)
+    {
+        return LivePatch(address, reinterpret_cast<const char*>(&value), sizeof(T), instruction);
+    }
 
-                DWORD oldState;
-                if (!VirtualProtect(thunk, sizeof(void*), PAGE_READWRITE, &oldState))
-                    return FALSE;
+    // Import indexes are built on first use and kept for the life of the process.
+    const ImportIndex::Index* Imports(HMODULE module)
+    {
+        static std::mutex indexMutex;
+        static std::unordered_map<HMODULE, std::optional<ImportIndex::Index>> indexes;
+
+        std::lock_guard lock(indexMutex);
+        auto it = indexes.find(module);
+        if (it == indexes.end())
+        {
+            auto base = reinterpret_cast<const std::uint8_t*>(module);
+            auto ntHeaders = (PIMAGE_NT_HEADERS)(base + ((PIMAGE_DOS_HEADER)base)->e_lfanew);
+            std::string error;
+            it = indexes.emplace(module, ImportIndex::Index::Parse(base, ntHeaders->OptionalHeader.SizeOfImage, ImportIndex::Layout::Mapped, error)).first;
+        }
+        return it->second ? &*it->second : nullptr;
+    }
+
+    bool IsImported(HMODULE callerModule, const char* targetModule, const char* functionName)
+    {
+        auto index = Imports(callerModule);
+        return index && index->Find(targetModule, functionName);
+    }
+
+    struct IATHook
+    {
+        const char* module;
+        const char* function;       // nullptr to hook by ordinal
+        void* detour;
+        void** original;            // Receives whatever the slot held before, so hooks chain. Untouched when not imported
+        std::uint16_t ordinal = 0;
+        bool hooked = false;
+        void** slot = nullptr;
+    };
+
+    template <typename T>
+    IATHook MakeIATHook(const char* targetModule, const char* functionName, T detour, T& original)
+    {
+        return { targetModule, functionName, reinterpret_cast<void*>(detour), reinterpret_cast<void**>(&original) };
+    }
+
+    // Makes every page holding one of the slots writable, runs write, then puts the old protection back.
+    // IATs are usually contiguous, so this tends to be a single VirtualProtect each way however many slots there are.
+    template <typename Write>
+    bool WithWritableSlots(const std::vector<void**>& slots, Write&& write)
+    {
+        SYSTEM_INFO si{};
+        GetSystemInfo(&si);
+        const std::uintptr_t pageSize = si.dwPageSize;
+
+        std::vector<std::uintptr_t> pages;
+        for (void** slot : slots)
+            pages.push_back(reinterpret_cast<std::uintptr_t>(slot) & ~(pageSize - 1));
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+        struct Protected
+        {
+            void* address;
+            SIZE_T size;
+            DWORD oldProtect;
+        };
+        std::vector<Protected> changed;
+
+        bool ok = true;
+        for (std::size_t i = 0; i < pages.size() && ok;)
+        {
+            // Merge runs of adjacent pages, then split them wherever the current protection changes.
+            std::size_t j = i + 1;
+            while (j < pages.size() && pages[j] == pages[j - 1] + pageSize)
+                ++j;
+
+            for (std::uintptr_t start = pages[i], end = pages[j - 1] + pageSize; start < end && ok;)
+            {
+                MEMORY_BASIC_INFORMATION mbi{};
+                if (!VirtualQuery(reinterpret_cast<void*>(start), &mbi, sizeof(mbi)))
+                {
+                    ok = false;
+                    break;
+                }
+
+                std::uintptr_t regionEnd = std::min(reinterpret_cast<std::uintptr_t>(mbi.BaseAddress) + mbi.RegionSize, end);
+                Protected region{ reinterpret_cast<void*>(start), regionEnd - start, 0 };
+                ok = VirtualProtect(region.address, region.size, PAGE_READWRITE, &region.oldProtect);
+                if (ok)
+                    changed.push_back(region);
+                start = regionEnd;
+            }
+            i = j;
+        }
+
+        if (ok)
+            write();
+
+        for (auto& region : changed)
+            VirtualProtect(region.address, region.size, region.oldProtect, &region.oldProtect);
+        return ok;
+    }
+
+    // Hooks every import in the list under one protection change, marking which ones were found.
+    // Slots are written in list order. Returns the number of hooks installed.
+    std::size_t HookIATBatch(HMODULE callerModule, std::vector<IATHook>& hooks)
+    {
+        auto index = Imports(callerModule);
+        if (!index)
+            return 0;
+
+        auto base = reinterpret_cast<std::uint8_t*>(callerModule);
+        auto ntHeaders = (PIMAGE_NT_HEADERS)(base + ((PIMAGE_DOS_HEADER)base)->e_lfanew);
+        auto imageEnd = base + ntHeaders->OptionalHeader.SizeOfImage;
+
+        std::vector<void**> slots;
+        std::vector<void*> originals(hooks.size());
+        for (std::size_t i = 0; i < hooks.size(); ++i)
+        {
+            auto& hook = hooks[i];
+            if (hook.hooked)
+                continue;
+            hook.slot = nullptr;
 
-                *thunk = detourFunction;
+            const auto* import = hook.function ? index->Find(hook.module, hook.function) : index->Find(hook.module, hook.ordinal);
+            if (!import)
+                continue;
 
-                VirtualProtect(thunk, sizeof(void*), oldState, &oldState);
+            // An untouched delay-load slot still points at the loader stub in this module. Calling that would
+            // resolve the import and overwrite the hook, and resolving it here means loading a library, which can
+            // run under the loader lock from DllMain. Leave it alone until the game has bound it itself.
+            auto slot = reinterpret_cast<void**>(base + import->slot);
+            auto current = static_cast<std::uint8_t*>(*slot);
+            if (import->delayLoad && current >= base && current < imageEnd)
+                continue;
+
+            hook.slot = slot;
+            originals[i] = current;
+            slots.push_back(hook.slot);
+        }
+
+        if (slots.empty())
+            return 0;
+
+        std::size_t installed = 0;
+        WithWritableSlots(slots, [&]
+        {
+            for (std::size_t i = 0; i < hooks.size(); ++i)
+            {
+                auto& hook = hooks[i];
+                if (!hook.slot)
+                    continue;
 
-                return TRUE;
+                // The original has to be in place before the detour can be reached.
+                *hook.original = originals[i];
+                InterlockedExchangePointer(hook.slot, hook.detour);
+                hook.hooked = true;
+                installed++;
             }
+        });
+        return installed;
+    }
+
+    // Puts the originals back for every hook in the list that is still the one in its slot.
+    std::size_t UnhookIATBatch(std::vector<IATHook>& hooks)
+    {
+        std::vector<void**> slots;
+        for (const auto& hook : hooks)
+        {
+            if (hook.hooked)
+                slots.push_back(hook.slot);
         }
-        return FALSE;
+
+        if (slots.empty())
+            return 0;
+
+        std::size_t removed = 0;
+        WithWritableSlots(slots, [&]
+        {
+            for (auto& hook : hooks)
+            {
+                if (!hook.hooked)
+                    continue;
+
+                // Something hooked over the top of this one, taking it out now would drop that hook too.
+                if (InterlockedCompareExchangePointer(hook.slot, *hook.original, hook.detour) == hook.detour)
+                {
+                    hook.hooked = false;
+                    removed++;
+                }
+            }
+        });
+        return removed;
     }
 }
 
@@ -204,9 +894,46 @@ namespace Util
             });
     }
 
+    // Local date and time for naming per-session output files, e.g. 20250226_153000.
+    std::string session_timestamp()
+    {
+        SYSTEMTIME time{};
+        GetLocalTime(&time);
+        return std::format("{:04}{:02}{:02}_{:02}{:02}{:02}", time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond);
+    }
+
     bool file_exists(const WCHAR* fileName)
     {
         DWORD dwAttrib = GetFileAttributesW(fileName);
         return (dwAttrib != INVALID_FILE_ATTRIBUTES && !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
     }
+
+    struct PeriodicTask
+    {
+        DWORD interval;
+        void (*run)();
+    };
+
+    DWORD __stdcall PeriodicThread(void* param)
+    {
+        auto task = static_cast<PeriodicTask*>(param);
+        while (true)
+        {
+            Sleep(task->interval);
+            task->run();
+        }
+        return 0;
+    }
+
+    // Calls run every interval on a background thread for the life of the process, e.g. for a feature's stats log.
+    void run_periodically(std::chrono::milliseconds interval, void (*run)())
+    {
+        // Never freed, the thread never exits.
+        auto task = new PeriodicTask{ static_cast<DWORD>(interval.count()), run };
+        HANDLE handle = CreateThread(NULL, 0, PeriodicThread, task, NULL, 0);
+        if (handle)
+            CloseHandle(handle);
+        else
+            delete task;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Import table index.
+// Walks a PE image's import and delay-load import descriptors once and indexes every IAT slot by module and
+// function name or ordinal. Only standard headers are used, so the same parser works on a loaded module or on
+// a PE file read from disk.
+namespace ImportIndex
+{
+    // Mapped: the image as the loader lays it out, RVAs are offsets. File: the raw file, RVAs go through the section table.
+    enum class Layout
+    {
+        Mapped,
+        File
+    };
+
+    struct Import
+    {
+        std::string module;         // Lower case
+        std::string name;           // Empty when imported by ordinal
+        std::uint16_t ordinal;      // Ordinal, or the name hint
+        std::uint32_t slot;         // RVA of the IAT slot
+        bool delayLoad;
+    };
+
+    class Index
+    {
+    public:
+        static std::optional<Index> Parse(const std::uint8_t* image, std::size_t size, Layout layout, std::string& error)
+        {
+            Index index;
+            Parser parser{ image, size, layout };
+            if (!parser.Headers(error))
+                return std::nullopt;
+
+            index.m_slotSize = parser.is64 ? 8 : 4;
+            index.m_imageBase = parser.imageBase;
+            if (!parser.Imports(index.m_imports, error) || !parser.DelayImports(index.m_imports, error))
+                return std::nullopt;
+
+            // Regular imports come first, so they win if the same function is somehow listed twice.
+            for (std::size_t i = 0; i < index.m_imports.size(); ++i)
+            {
+                const auto& import = index.m_imports[i];
+                index.m_lookup.try_emplace(import.name.empty() ? OrdinalKey(import.module, import.ordinal) : NameKey(import.module, import.name), i);
+            }
+            return index;
+        }
+
+        const Import* Find(std::string_view module, std::string_view name) const
+        {
+            return Lookup(NameKey(Lower(module), name));
+        }
+
+        const Import* Find(std::string_view module, std::uint16_t ordinal) const
+        {
+            return Lookup(OrdinalKey(Lower(module), ordinal));
+        }
+
+        const std::vector<Import>& Imports() const { return m_imports; }
+        std::size_t SlotSize() const { return m_slotSize; }
+        std::uint64_t ImageBase() const { return m_imageBase; }
+
+    private:
+        static std::string Lower(std::string_view text)
+        {
+            std::string lower(text);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return lower;
+        }
+
+        static std::string NameKey(const std::string& module, std::string_view name)
+        {
+            return module + '!' + std::string(name);
+        }
+
+        static std::string OrdinalKey(const std::string& module, std::uint16_t ordinal)
+        {
+            return module + '#' + std::to_string(ordinal);
+        }
+
+        const Import* Lookup(const std::string& key) const
+        {
+            auto it = m_lookup.find(key);
+            return it != m_lookup.end() ? &m_imports[it->second] : nullptr;
+        }
+
+        struct Parser
+        {
+            const std::uint8_t* image;
+            std::size_t size;
+            Layout layout;
+
+            bool is64 = false;
+            std::uint64_t imageBase = 0;
+            std::uint32_t sizeOfHeaders = 0;
+            std::size_t sectionsOffset = 0;
+            std::uint16_t sectionCount = 0;
+            std::uint32_t importRva = 0;
+            std::uint32_t delayImportRva = 0;
+
+            template <typename T>
+            bool Read(std::size_t offset, T& value) const
+            {
+                if (offset > size || size - offset < sizeof(T))
+                    return false;
+                std::memcpy(&value, image + offset, sizeof(T));
+                return true;
+            }
+
+            // File offset of an RVA, or nothing if it isn't backed by the image.
+            std::optional<std::size_t> Offset(std::uint32_t rva) const
+            {
+                if (layout == Layout::Mapped || rva < sizeOfHeaders)
+                    return rva < size ? std::optional<std::size_t>(rva) : std::nullopt;
+
+                for (std::uint16_t i = 0; i < sectionCount; ++i)
+                {
+                    std::size_t section = sectionsOffset + i * 40;
+                    std::uint32_t virtualSize = 0, virtualAddress = 0, rawSize = 0, rawPointer = 0;
+                    if (!Read(section + 8, virtualSize) || !Read(section + 12, virtualAddress) || !Read(section + 16, rawSize) || !Read(section + 20, rawPointer))
+                        return std::nullopt;
+
+                    if (rva >= virtualAddress && rva - virtualAddress < std::max(virtualSize, rawSize))
+                    {
+                        std::uint32_t delta = rva - virtualAddress;
+                        if (delta >= rawSize || std::size_t(rawPointer) + delta >= size)
+                            return std::nullopt;
+                        return std::size_t(rawPointer) + delta;
+                    }
+                }
+                return std::nullopt;
+            }
+
+            template <typename T>
+            bool ReadRva(std::uint32_t rva, T& value) const
+            {
+                auto offset = Offset(rva);
+                return offset && Read(*offset, value);
+            }
+
+            std::optional<std::string> String(std::uint32_t rva) const
+            {
+                auto offset = Offset(rva);
+                if (!offset)
+                    return std::nullopt;
+
+                auto begin = reinterpret_cast<const char*>(image + *offset);
+                auto end = std::find(begin, begin + (size - *offset), '\0');
+                if (end == begin + (size - *offset))
+                    return std::nullopt;
+                return std::string(begin, end);
+            }
+
+            bool Headers(std::string& error)
+            {
+                std::uint16_t dosMagic = 0;
+                std::uint32_t ntOffset = 0, signature = 0;
+                if (!Read(0, dosMagic) || dosMagic != 0x5A4D || !Read(0x3C, ntOffset) || !Read(ntOffset, signature) || signature != 0x00004550)
+                {
+                    error = "not a PE image";
+                    return false;
+                }
+
+                std::uint16_t optionalSize = 0, magic = 0;
+                std::size_t optional = std::size_t(ntOffset) + 24;
+                if (!Read(ntOffset + 6, sectionCount) || !Read(ntOffset + 20, optionalSize) || !Read(optional, magic) || (magic != 0x10B && magic != 0x20B))
+                {
+                    error = "unsupported optional header";
+                    return false;
+                }
+
+                is64 = magic == 0x20B;
+                sectionsOffset = optional + optionalSize;
+
+                std::uint32_t directoryCount = 0;
+                std::size_t directories = optional + (is64 ? 112 : 96);
+                bool read = Read(optional + 60, sizeOfHeaders) && Read(optional + (is64 ? 108 : 92), directoryCount);
+                if (is64)
+                {
+                    read = read && Read(optional + 24, imageBase);
+                }
+                else
+                {
+                    std::uint32_t imageBase32 = 0;
+                    read = read && Read(optional + 28, imageBase32);
+                    imageBase = imageBase32;
+                }
+                if (!read)
+                {
+                    error = "truncated optional header";
+                    return false;
+                }
+
+                // Data directory 1 is the import table, 13 the delay-load import table.
+                if (directoryCount > 1 && !Read(directories + 1 * 8, importRva))
+                    importRva = 0;
+                if (directoryCount > 13 && !Read(directories + 13 * 8, delayImportRva))
+                    delayImportRva = 0;
+                return true;
+            }
+
+            // Walks one name table alongside its IAT.
+            bool Thunks(const std::string& module, std::uint32_t namesRva, std::uint32_t slotsRva, bool delayLoad, std::vector<Import>& imports, std::string& error) const
+            {
+                const std::uint32_t slotSize = is64 ? 8 : 4;
+                const std::uint64_t ordinalFlag = is64 ? 0x8000000000000000ull : 0x80000000ull;
+
+                for (std::uint32_t i = 0;; ++i)
+                {
+                    std::uint64_t thunk = 0;
+                    bool read = false;
+                    if (is64)
+                    {
+                        read = ReadRva(namesRva + i * slotSize, thunk);
+                    }
+                    else
+                    {
+                        std::uint32_t thunk32 = 0;
+                        read = ReadRva(namesRva + i * slotSize, thunk32);
+                        thunk = thunk32;
+                    }
+                    if (!read)
+                    {
+                        error = "import name table for " + module + " runs off the image";
+                        return false;
+                    }
+                    if (!thunk)
+                        return true;
+
+                    Import import{ module, {}, 0, slotsRva + i * slotSize, delayLoad };
+                    if (thunk & ordinalFlag)
+                    {
+                        import.ordinal = static_cast<std::uint16_t>(thunk & 0xFFFF);
+                    }
+                    else
+                    {
+                        auto nameRva = static_cast<std::uint32_t>(thunk);
+                        auto name = String(nameRva + 2);
+                        if (!ReadRva(nameRva, import.ordinal) || !name)
+                        {
+                            error = "bad import name in " + module;
+                            return false;
+                        }
+                        import.name = std::move(*name);
+                    }
+                    imports.push_back(std::move(import));
+                }
+            }
+
+            bool Imports(std::vector<Import>& imports, std::string& error) const
+            {
+                if (!importRva)
+                    return true;
+
+                for (std::uint32_t descriptor = importRva;; descriptor += 20)
+                {
+                    std::uint32_t originalFirstThunk = 0, nameRva = 0, firstThunk = 0;
+                    if (!ReadRva(descriptor, originalFirstThunk) || !ReadRva(descriptor + 12, nameRva) || !ReadRva(descriptor + 16, firstThunk))
+                    {
+                        error = "import directory runs off the image";
+                        return false;
+                    }
+                    if (!nameRva && !firstThunk)
+                        return true;
+
+                    auto module = String(nameRva);
+                    if (!module)
+                    {
+                        error = "bad import module name";
+                        return false;
+                    }
+
+                    // Without a name table the names only survive in the IAT until the loader binds it.
+                    std::uint32_t namesRva = originalFirstThunk ? originalFirstThunk : (layout == Layout::File ? firstThunk : 0);
+                    if (namesRva && !Thunks(Lower(*module), namesRva, firstThunk, false, imports, error))
+                        return false;
+                }
+            }
+
+            bool DelayImports(std::vector<Import>& imports, std::string& error) const
+            {
+                if (!delayImportRva)
+                    return true;
+
+                for (std::uint32_t descriptor = delayImportRva;; descriptor += 32)
+                {
+                    std::uint32_t attributes = 0, nameRva = 0, slotsRva = 0, namesRva = 0;
+                    if (!ReadRva(descriptor, attributes) || !ReadRva(descriptor + 4, nameRva) || !ReadRva(descriptor + 12, slotsRva) || !ReadRva(descriptor + 16, namesRva))
+                    {
+                        error = "delay-load import directory runs off the image";
+                        return false;
+                    }
+                    if (!nameRva)
+                        return true;
+
+                    // Old style descriptors hold virtual addresses instead of RVAs.
+                    if (!(attributes & 1))
+                    {
+                        nameRva = static_cast<std::uint32_t>(nameRva - imageBase);
+                        slotsRva = static_cast<std::uint32_t>(slotsRva - imageBase);
+                        namesRva = static_cast<std::uint32_t>(namesRva - imageBase);
+                    }
+
+                    auto module = String(nameRva);
+                    if (!module)
+                    {
+                        error = "bad delay-load module name";
+                        return false;
+                    }
+                    if (!Thunks(Lower(*module), namesRva, slotsRva, true, imports, error))
+                        return false;
+                }
+            }
+        };
+
+        std::vector<Import> m_imports;
+        std::unordered_map<std::string, std::size_t> m_lookup;
+        std::size_t m_slotSize = 8;
+        std::uint64_t m_imageBase = 0;
+    };
+}
@@ -0,0 +1,473 @@
+#pragma once
+
+#include "stdafx.h"
+#include "helper.hpp"
+
+#include <spdlog/spdlog.h>
+
+// Asset I/O tracing through IAT hooks on the game's file APIs.
+// Each thread appends read records to its own single-producer ring buffer without locking, a background
+// thread drains them to a CSV trace and keeps a running list of the slowest reads for the log.
+namespace IOTrace
+{
+    constexpr std::size_t kBufferCapacity = 4096;
+    constexpr std::size_t kSlowestReads = 10;
+
+    struct Record
+    {
+        std::int64_t start;             // QPC ticks
+        std::int64_t duration;          // QPC ticks
+        std::uint64_t offset;
+        std::uint32_t file;             // Index into the path table
+        std::uint32_t bytesRequested;
+        std::uint32_t bytesRead;
+        std::uint32_t threadID;
+        bool overlapped;
+    };
+
+    struct ThreadBuffer
+    {
+        std::array<Record, kBufferCapacity> records{};
+        std::atomic<std::size_t> head{ 0 };   // Written by the owning thread
+        std::atomic<std::size_t> tail{ 0 };   // Written by the flush thread
+        std::atomic<std::uint64_t> dropped{ 0 };
+    };
+
+    struct OpenFile
+    {
+        std::uint32_t path;
+        std::atomic<std::uint64_t> position{ 0 };
+    };
+
+    struct PendingRead
+    {
+        HANDLE handle;
+        std::int64_t start;
+        std::uint64_t offset;
+        std::uint32_t file;
+        std::uint32_t bytesRequested;
+        std::uint32_t threadID;
+    };
+
+    // File table, only touched on open/close/seek so a shared lock is fine here.
+    std::shared_mutex fileMutex;
+    std::vector<std::wstring> paths;
+    std::unordered_map<std::wstring, std::uint32_t> pathIndex;
+    std::deque<OpenFile> openFiles;     // Entries are recycled through freeFiles, a deque since they hold an atomic
+    std::vector<std::uint32_t> freeFiles;
+    std::unordered_map<HANDLE, std::uint32_t> handleIndex;
+
+    std::mutex pendingMutex;
+    std::unordered_map<LPOVERLAPPED, PendingRead> pendingReads;
+    std::atomic<std::size_t> pendingCount{ 0 };
+
+    std::mutex buffersMutex;
+    std::vector<ThreadBuffer*> buffers;
+
+    std::filesystem::path tracePath;
+    DWORD iFlushInterval = 1000;
+    LARGE_INTEGER qpcFrequency{};
+    LARGE_INTEGER qpcStart{};
+
+    decltype(&CreateFileW) CreateFileW_Fn;
+    decltype(&ReadFile) ReadFile_Fn;
+    decltype(&SetFilePointerEx) SetFilePointerEx_Fn;
+    decltype(&CloseHandle) CloseHandle_Fn;
+    decltype(&GetOverlappedResult) GetOverlappedResult_Fn;
+    decltype(&GetOverlappedResultEx) GetOverlappedResultEx_Fn;
+    decltype(&GetQueuedCompletionStatus) GetQueuedCompletionStatus_Fn;
+    decltype(&GetQueuedCompletionStatusEx) GetQueuedCompletionStatusEx_Fn;
+
+    std::int64_t Now()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    ThreadBuffer& LocalBuffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer)
+        {
+            // Buffers outlive their threads so the flush thread never races a thread exit.
+            buffer = new ThreadBuffer();
+            std::lock_guard lock(buffersMutex);
+            buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    void Push(const Record& record)
+    {
+        auto& buffer = LocalBuffer();
+        auto head = buffer.head.load(std::memory_order_relaxed);
+        if (head - buffer.tail.load(std::memory_order_acquire) >= kBufferCapacity)
+        {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        buffer.records[head % kBufferCapacity] = record;
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Runs fn on the handle's entry under the shared lock, so a close can't recycle it for another file meanwhile.
+    template <typename Fn>
+    bool WithFile(HANDLE hFile, Fn&& fn)
+    {
+        std::shared_lock lock(fileMutex);
+        auto it = handleIndex.find(hFile);
+        if (it == handleIndex.end())
+            return false;
+        fn(openFiles[it->second]);
+        return true;
+    }
+
+    void RecordCompletion(const PendingRead& pending, DWORD bytesRead)
+    {
+        // Latency runs until the game observes the completion, which is what it actually waited for.
+        Push({ pending.start, Now() - pending.start, pending.offset, pending.file, pending.bytesRequested, bytesRead, pending.threadID, true });
+    }
+
+    HANDLE WINAPI CreateFileW_Hook(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+    {
+        HANDLE hFile = CreateFileW_Fn(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+        if (hFile == INVALID_HANDLE_VALUE || !lpFileName || !(dwDesiredAccess & (GENERIC_READ | FILE_READ_DATA)))
+            return hFile;
+
+        DWORD lastError = GetLastError();
+        {
+            std::unique_lock lock(fileMutex);
+            auto [it, inserted] = pathIndex.try_emplace(lpFileName, static_cast<std::uint32_t>(paths.size()));
+            if (inserted)
+                paths.emplace_back(lpFileName);
+
+            std::uint32_t entry;
+            if (!freeFiles.empty())
+            {
+                entry = freeFiles.back();
+                freeFiles.pop_back();
+            }
+            else
+            {
+                entry = static_cast<std::uint32_t>(openFiles.size());
+                openFiles.emplace_back();
+            }
+
+            openFiles[entry].path = it->second;
+            openFiles[entry].position.store(0, std::memory_order_relaxed);
+            handleIndex[hFile] = entry;
+        }
+        SetLastError(lastError);
+        return hFile;
+    }
+
+    BOOL WINAPI CloseHandle_Hook(HANDLE hObject)
+    {
+        bool tracked;
+        {
+            std::shared_lock lock(fileMutex);
+            tracked = handleIndex.contains(hObject);
+        }
+
+        if (tracked)
+        {
+            {
+                std::unique_lock lock(fileMutex);
+                auto it = handleIndex.find(hObject);
+                if (it != handleIndex.end())
+                {
+                    freeFiles.push_back(it->second);
+                    handleIndex.erase(it);
+                }
+            }
+
+            // Reads the game never collected through a completion call, e.g. cancelled ones it only waited on by
+            // event. Nothing can observe them after the close, so they're recorded as failed.
+            if (pendingCount.load(std::memory_order_relaxed))
+            {
+                std::vector<PendingRead> abandoned;
+                {
+                    std::lock_guard lock(pendingMutex);
+                    std::erase_if(pendingReads, [&](const auto& entry)
+                    {
+                        if (entry.second.handle != hObject)
+                            return false;
+                        abandoned.push_back(entry.second);
+                        return true;
+                    });
+                    pendingCount.store(pendingReads.size(), std::memory_order_relaxed);
+                }
+                for (const auto& pending : abandoned)
+                    RecordCompletion(pending, 0);
+            }
+        }
+        return CloseHandle_Fn(hObject);
+    }
+
+    BOOL WINAPI SetFilePointerEx_Hook(HANDLE hFile, LARGE_INTEGER liDistanceToMove, PLARGE_INTEGER lpNewFilePointer, DWORD dwMoveMethod)
+    {
+        LARGE_INTEGER newPosition{};
+        BOOL result = SetFilePointerEx_Fn(hFile, liDistanceToMove, &newPosition, dwMoveMethod);
+        if (result)
+        {
+            WithFile(hFile, [&](OpenFile& file) { file.position.store(static_cast<std::uint64_t>(newPosition.QuadPart), std::memory_order_relaxed); });
+            if (lpNewFilePointer)
+                *lpNewFilePointer = newPosition;
+        }
+        return result;
+    }
+
+    BOOL WINAPI ReadFile_Hook(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+    {
+        std::uint64_t offset = 0;
+        std::uint32_t path = 0;
+        bool tracked = WithFile(hFile, [&](OpenFile& file)
+        {
+            path = file.path;
+            offset = file.position.load(std::memory_order_relaxed);
+        });
+        if (!tracked)
+            return ReadFile_Fn(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+
+        if (lpOverlapped)
+            offset = (static_cast<std::uint64_t>(lpOverlapped->OffsetHigh) << 32) | lpOverlapped->Offset;
+        std::int64_t start = Now();
+
+        // An overlapped read can complete on a port thread before ReadFile even returns, so it's registered up front.
+        if (lpOverlapped)
+        {
+            std::lock_guard lock(pendingMutex);
+            pendingReads[lpOverlapped] = { hFile, start, offset, path, nNumberOfBytesToRead, GetCurrentThreadId() };
+            pendingCount.store(pendingReads.size(), std::memory_order_relaxed);
+        }
+
+        BOOL result = ReadFile_Fn(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+        std::int64_t end = Now();
+        DWORD lastError = GetLastError();
+
+        // Pending reads complete later through GetOverlappedResult(Ex) or an I/O completion port.
+        if (result || !lpOverlapped || lastError != ERROR_IO_PENDING)
+        {
+            bool record = true;
+            if (lpOverlapped)
+            {
+                // Completed or failed synchronously. If the entry is already gone a completion hook recorded it.
+                std::lock_guard lock(pendingMutex);
+                record = pendingReads.erase(lpOverlapped) != 0;
+                pendingCount.store(pendingReads.size(), std::memory_order_relaxed);
+            }
+
+            DWORD bytesRead = 0;
+            if (result)
+                bytesRead = lpNumberOfBytesRead ? *lpNumberOfBytesRead : static_cast<DWORD>(lpOverlapped->InternalHigh);
+            if (!lpOverlapped)
+                WithFile(hFile, [&](OpenFile& file) { file.position.fetch_add(bytesRead, std::memory_order_relaxed); });
+
+            if (record)
+                Push({ start, end - start, offset, path, nNumberOfBytesToRead, bytesRead, GetCurrentThreadId(), lpOverlapped != nullptr });
+        }
+
+        SetLastError(lastError);
+        return result;
+    }
+
+    void CompleteRead(LPOVERLAPPED lpOverlapped, DWORD bytesRead)
+    {
+        if (!lpOverlapped || pendingCount.load(std::memory_order_relaxed) == 0)
+            return;
+
+        PendingRead pending;
+        {
+            std::lock_guard lock(pendingMutex);
+            auto it = pendingReads.find(lpOverlapped);
+            if (it == pendingReads.end())
+                return;
+            pending = it->second;
+            pendingReads.erase(it);
+            pendingCount.store(pendingReads.size(), std::memory_order_relaxed);
+        }
+
+        RecordCompletion(pending, bytesRead);
+    }
+
+    // GetOverlappedResult(Ex) also fails while the read is still in flight, only other errors end it.
+    bool StillPending(DWORD error)
+    {
+        return error == ERROR_IO_INCOMPLETE || error == WAIT_TIMEOUT || error == WAIT_IO_COMPLETION;
+    }
+
+    BOOL WINAPI GetOverlappedResult_Hook(HANDLE hFile, LPOVERLAPPED lpOverlapped, LPDWORD lpNumberOfBytesTransferred, BOOL bWait)
+    {
+        BOOL result = GetOverlappedResult_Fn(hFile, lpOverlapped, lpNumberOfBytesTransferred, bWait);
+        DWORD lastError = GetLastError();
+        if (result)
+            CompleteRead(lpOverlapped, *lpNumberOfBytesTransferred);
+        else if (!StillPending(lastError))
+            CompleteRead(lpOverlapped, 0);
+        SetLastError(lastError);
+        return result;
+    }
+
+    BOOL WINAPI GetOverlappedResultEx_Hook(HANDLE hFile, LPOVERLAPPED lpOverlapped, LPDWORD lpNumberOfBytesTransferred, DWORD dwMilliseconds, BOOL bAlertable)
+    {
+        BOOL result = GetOverlappedResultEx_Fn(hFile, lpOverlapped, lpNumberOfBytesTransferred, dwMilliseconds, bAlertable);
+        DWORD lastError = GetLastError();
+        if (result)
+            CompleteRead(lpOverlapped, *lpNumberOfBytesTransferred);
+        else if (!StillPending(lastError))
+            CompleteRead(lpOverlapped, 0);
+        SetLastError(lastError);
+        return result;
+    }
+
+    BOOL WINAPI GetQueuedCompletionStatus_Hook(HANDLE CompletionPort, LPDWORD lpNumberOfBytesTransferred, PULONG_PTR lpCompletionKey, LPOVERLAPPED* lpOverlapped, DWORD dwMilliseconds)
+    {
+        BOOL result = GetQueuedCompletionStatus_Fn(CompletionPort, lpNumberOfBytesTransferred, lpCompletionKey, lpOverlapped, dwMilliseconds);
+
+        // A failure with an OVERLAPPED is a failed or cancelled read dequeued from the port, without one a timeout.
+        DWORD lastError = GetLastError();
+        if (*lpOverlapped)
+            CompleteRead(*lpOverlapped, result ? *lpNumberOfBytesTransferred : 0);
+        SetLastError(lastError);
+        return result;
+    }
+
+    BOOL WINAPI GetQueuedCompletionStatusEx_Hook(HANDLE CompletionPort, LPOVERLAPPED_ENTRY lpCompletionPortEntries, ULONG ulCount, PULONG ulNumEntriesRemoved, DWORD dwMilliseconds, BOOL fAlertable)
+    {
+        BOOL result = GetQueuedCompletionStatusEx_Fn(CompletionPort, lpCompletionPortEntries, ulCount, ulNumEntriesRemoved, dwMilliseconds, fAlertable);
+        if (result)
+        {
+            DWORD lastError = GetLastError();
+            for (ULONG i = 0; i < *ulNumEntriesRemoved; ++i)
+                CompleteRead(lpCompletionPortEntries[i].lpOverlapped, lpCompletionPortEntries[i].dwNumberOfBytesTransferred);
+            SetLastError(lastError);
+        }
+        return result;
+    }
+
+    double ToMicroseconds(std::int64_t ticks)
+    {
+        return static_cast<double>(ticks) * 1'000'000.0 / static_cast<double>(qpcFrequency.QuadPart);
+    }
+
+    std::string PathString(std::uint32_t path)
+    {
+        std::shared_lock lock(fileMutex);
+        return path < paths.size() ? Util::wstring_to_string(paths[path]) : std::string{};
+    }
+
+    void LogSummary(const std::vector<Record>& slowest, std::uint64_t reads, std::uint64_t bytes, std::int64_t totalTicks, std::uint64_t dropped)
+    {
+        if (reads == 0)
+            return;
+
+        spdlog::info("IO Trace: {} read(s), {:.2f} MB, average latency {:.1f}us, {} dropped record(s).", reads, bytes / (1024.0 * 1024.0), ToMicroseconds(totalTicks) / reads, dropped);
+        for (const auto& record : slowest)
+            spdlog::info("IO Trace: Slow read: {:.1f}us | {} bytes @ 0x{:x} | {}", ToMicroseconds(record.duration), record.bytesRead, record.offset, PathString(record.file));
+    }
+
+    DWORD __stdcall FlushThread(void*)
+    {
+        std::ofstream traceFile(tracePath);
+        if (!traceFile)
+        {
+            spdlog::error("IO Trace: Failed to create {}", tracePath.string());
+            return 0;
+        }
+        traceFile << "thread_id,file,offset,bytes_requested,bytes_read,start_us,latency_us,overlapped\n";
+
+        std::vector<Record> slowest;
+        std::uint64_t reads = 0;
+        std::uint64_t bytes = 0;
+        std::int64_t totalTicks = 0;
+        std::uint64_t lastSummaryReads = 0;
+        auto lastSummary = std::chrono::steady_clock::now();
+
+        while (true)
+        {
+            Sleep(iFlushInterval);
+
+            std::vector<ThreadBuffer*> snapshot;
+            {
+                std::lock_guard lock(buffersMutex);
+                snapshot = buffers;
+            }
+
+            std::uint64_t dropped = 0;
+            for (auto buffer : snapshot)
+            {
+                auto tail = buffer->tail.load(std::memory_order_relaxed);
+                auto head = buffer->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail)
+                {
+                    const auto& record = buffer->records[tail % kBufferCapacity];
+                    traceFile << std::format("{},\"{}\",{},{},{},{:.1f},{:.1f},{}\n", record.threadID, PathString(record.file), record.offset, record.bytesRequested, record.bytesRead,
+                        ToMicroseconds(record.start - qpcStart.QuadPart), ToMicroseconds(record.duration), record.overlapped ? 1 : 0);
+
+                    reads++;
+                    bytes += record.bytesRead;
+                    totalTicks += record.duration;
+
+                    if (slowest.size() < kSlowestReads || record.duration > slowest.back().duration)
+                    {
+                        if (slowest.size() == kSlowestReads)
+                            slowest.pop_back();
+                        slowest.insert(std::upper_bound(slowest.begin(), slowest.end(), record, [](const Record& a, const Record& b) { return a.duration > b.duration; }), record);
+                    }
+                }
+                buffer->tail.store(tail, std::memory_order_release);
+                dropped += buffer->dropped.load(std::memory_order_relaxed);
+            }
+            traceFile.flush();
+
+            if (reads != lastSummaryReads && std::chrono::steady_clock::now() - lastSummary > std::chrono::seconds(60))
+            {
+                LogSummary(slowest, reads, bytes, totalTicks, dropped);
+                lastSummaryReads = reads;
+                lastSummary = std::chrono::steady_clock::now();
+            }
+        }
+
+        return 0;
+    }
+
+    void Install(HMODULE module, const std::filesystem::path& path, DWORD flushInterval)
+    {
+        tracePath = path;
+        iFlushInterval = flushInterval;
+        QueryPerformanceFrequency(&qpcFrequency);
+        QueryPerformanceCounter(&qpcStart);
+
+        // Handles must be known before reads can be attributed, so CreateFileW is required.
+        if (!Memory::IsImported(module, "kernel32.dll", "CreateFileW"))
+        {
+            spdlog::error("IO Trace: CreateFileW isn't imported, tracing disabled.");
+            return;
+        }
+
+        std::vector<Memory::IATHook> hooks = {
+            Memory::MakeIATHook("kernel32.dll", "CreateFileW", &CreateFileW_Hook, CreateFileW_Fn),
+            Memory::MakeIATHook("kernel32.dll", "ReadFile", &ReadFile_Hook, ReadFile_Fn),
+            Memory::MakeIATHook("kernel32.dll", "SetFilePointerEx", &SetFilePointerEx_Hook, SetFilePointerEx_Fn),
+            Memory::MakeIATHook("kernel32.dll", "CloseHandle", &CloseHandle_Hook, CloseHandle_Fn),
+            Memory::MakeIATHook("kernel32.dll", "GetOverlappedResult", &GetOverlappedResult_Hook, GetOverlappedResult_Fn),
+            Memory::MakeIATHook("kernel32.dll", "GetOverlappedResultEx", &GetOverlappedResultEx_Hook, GetOverlappedResultEx_Fn),
+            Memory::MakeIATHook("kernel32.dll", "GetQueuedCompletionStatus", &GetQueuedCompletionStatus_Hook, GetQueuedCompletionStatus_Fn),
+            Memory::MakeIATHook("kernel32.dll", "GetQueuedCompletionStatusEx", &GetQueuedCompletionStatusEx_Hook, GetQueuedCompletionStatusEx_Fn)
+        };
+        Memory::HookIATBatch(module, hooks);
+        for (const auto& hook : hooks)
+            spdlog::info("IO Trace: {}: {}", hook.function, hook.hooked ? "Hooked." : "Not imported.");
+
+        spdlog::info("IO Trace: Writing trace to {}", tracePath.string());
+        HANDLE flushHandle = CreateThread(NULL, 0, FlushThread, 0, CREATE_SUSPENDED, 0);
+        if (flushHandle)
+        {
+            SetThreadPriority(flushHandle, THREAD_PRIORITY_BELOW_NORMAL);
+            ResumeThread(flushHandle);
+            CloseHandle(flushHandle);
+        }
+    }
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include <safetyhook.hpp>
+
+// Mid-function hooks that only spill the registers a callback declares.
+// safetyhook::create_mid always saves every GPR and all 16 XMM registers. Callbacks here name the registers
+// they read or write at compile time and the stub is generated to match. Registers the Win64 ABI allows the
+// callback itself to clobber (rax, rcx, rdx, r8-r11, xmm0-xmm5 and rflags) are always preserved.
+namespace LeanHook
+{
+    // Laid out in hardware encoding order so the stub can address registers by number.
+    struct Context
+    {
+        safetyhook::Xmm xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7, xmm8, xmm9, xmm10, xmm11, xmm12, xmm13, xmm14, xmm15;
+        uintptr_t rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15;
+        uintptr_t rflags;
+    };
+
+    static_assert(offsetof(Context, rax) == 0x100 && offsetof(Context, r15) == 0x178 && offsetof(Context, rflags) == 0x180);
+
+    using MidHookFn = void (*)(Context& ctx);
+
+    enum Regs : std::uint64_t
+    {
+        None   = 0,
+        Rax    = 1ull << 0,  Rcx   = 1ull << 1,  Rdx   = 1ull << 2,  Rbx   = 1ull << 3,
+        Rsp    = 1ull << 4,  Rbp   = 1ull << 5,  Rsi   = 1ull << 6,  Rdi   = 1ull << 7,
+        R8     = 1ull << 8,  R9    = 1ull << 9,  R10   = 1ull << 10, R11   = 1ull << 11,
+        R12    = 1ull << 12, R13   = 1ull << 13, R14   = 1ull << 14, R15   = 1ull << 15,
+        Xmm0   = 1ull << 16, Xmm1  = 1ull << 17, Xmm2  = 1ull << 18, Xmm3  = 1ull << 19,
+        Xmm4   = 1ull << 20, Xmm5  = 1ull << 21, Xmm6  = 1ull << 22, Xmm7  = 1ull << 23,
+        Xmm8   = 1ull << 24, Xmm9  = 1ull << 25, Xmm10 = 1ull << 26, Xmm11 = 1ull << 27,
+        Xmm12  = 1ull << 28, Xmm13 = 1ull << 29, Xmm14 = 1ull << 30, Xmm15 = 1ull << 31,
+        Rflags = 1ull << 32,
+    };
+
+    constexpr std::uint64_t kAllRegs = (1ull << 33) - 1;
+    constexpr std::uint64_t kVolatileRegs = Rax | Rcx | Rdx | R8 | R9 | R10 | R11 | Xmm0 | Xmm1 | Xmm2 | Xmm3 | Xmm4 | Xmm5 | Rflags;
+
+    namespace detail
+    {
+        // Stack frame below the aligned rsp: shadow space, saved rsp slot, then the context.
+        constexpr std::int32_t kSavedRspOffset = 0x20;
+        constexpr std::int32_t kContextOffset = 0x30;
+        constexpr std::int32_t kFrameSize = kContextOffset + ((sizeof(Context) + 15) & ~15);
+
+        struct Stub
+        {
+            std::vector<std::uint8_t> code;
+            std::size_t destinationSlot = 0;
+            std::size_t trampolineSlot = 0;
+        };
+
+        void Emit(std::vector<std::uint8_t>& code, std::initializer_list<std::uint8_t> bytes)
+        {
+            code.insert(code.end(), bytes);
+        }
+
+        void Emit32(std::vector<std::uint8_t>& code, std::int32_t value)
+        {
+            for (int i = 0; i < 4; ++i)
+                code.push_back(static_cast<std::uint8_t>((static_cast<std::uint32_t>(value) >> (i * 8)) & 0xFF));
+        }
+
+        // mov/lea with a 64-bit register and [rsp + disp32]
+        void EmitGpr(std::vector<std::uint8_t>& code, std::uint8_t opcode, int reg, std::int32_t disp)
+        {
+            Emit(code, { static_cast<std::uint8_t>(0x48 | (reg >= 8 ? 0x04 : 0x00)), opcode, static_cast<std::uint8_t>(0x84 | ((reg & 7) << 3)), 0x24 });
+            Emit32(code, disp);
+        }
+
+        // movups with an xmm register and [rsp + disp32]
+        void EmitXmm(std::vector<std::uint8_t>& code, std::uint8_t opcode, int reg, std::int32_t disp)
+        {
+            if (reg >= 8)
+                code.push_back(0x44);
+            Emit(code, { 0x0F, opcode, static_cast<std::uint8_t>(0x84 | ((reg & 7) << 3)), 0x24 });
+            Emit32(code, disp);
+        }
+
+        std::int32_t GprOffset(int reg) { return kContextOffset + static_cast<std::int32_t>(offsetof(Context, rax)) + reg * 8; }
+        std::int32_t XmmOffset(int reg) { return kContextOffset + reg * 16; }
+        constexpr std::int32_t kRflagsOffset = kContextOffset + static_cast<std::int32_t>(offsetof(Context, rflags));
+
+        Stub BuildStub(std::uint64_t regs)
+        {
+            regs |= kVolatileRegs;
+
+            Stub stub{};
+            auto& code = stub.code;
+            std::vector<std::size_t> trampolineFixups;
+            std::vector<std::size_t> destinationFixups;
+
+            auto savesGpr = [regs](int reg) { return reg != 0 && reg != 4 && (regs & (1ull << reg)); };
+            auto savesXmm = [regs](int reg) { return (regs & (1ull << (16 + reg))) != 0; };
+
+            // push [rip+trampoline], so the final ret resumes at the trampoline
+            Emit(code, { 0xFF, 0x35 });
+            trampolineFixups.push_back(code.size());
+            Emit32(code, 0);
+
+            Emit(code, { 0x9C });                       // pushfq
+            Emit(code, { 0x50 });                       // push rax
+            Emit(code, { 0x48, 0x89, 0xE0 });           // mov rax, rsp
+            Emit(code, { 0x48, 0x83, 0xE4, 0xF0 });     // and rsp, -16
+            Emit(code, { 0x48, 0x81, 0xEC });           // sub rsp, kFrameSize
+            Emit32(code, kFrameSize);
+            EmitGpr(code, 0x89, 0, kSavedRspOffset);    // mov [rsp+saved], rax
+
+            for (int reg = 0; reg < 16; ++reg)
+                if (savesGpr(reg))
+                    EmitGpr(code, 0x89, reg, GprOffset(reg));
+
+            Emit(code, { 0x48, 0x8B, 0x08 });           // mov rcx, [rax]
+            EmitGpr(code, 0x89, 1, GprOffset(0));
+            Emit(code, { 0x48, 0x8B, 0x48, 0x08 });     // mov rcx, [rax+8]
+            EmitGpr(code, 0x89, 1, kRflagsOffset);
+
+            if (regs & Rsp)
+            {
+                Emit(code, { 0x48, 0x8D, 0x48, 0x18 }); // lea rcx, [rax+0x18]
+                EmitGpr(code, 0x89, 1, GprOffset(4));
+            }
+
+            for (int reg = 0; reg < 16; ++reg)
+                if (savesXmm(reg))
+                    EmitXmm(code, 0x11, reg, XmmOffset(reg));
+
+            EmitGpr(code, 0x8D, 1, kContextOffset);     // lea rcx, [rsp+context]
+
+            // call [rip+destination]
+            Emit(code, { 0xFF, 0x15 });
+            destinationFixups.push_back(code.size());
+            Emit32(code, 0);
+
+            for (int reg = 0; reg < 16; ++reg)
+                if (savesXmm(reg))
+                    EmitXmm(code, 0x10, reg, XmmOffset(reg));
+
+            // Write rax and rflags back to the slots pushed on entry, rsp is read-only
+            EmitGpr(code, 0x8B, 0, kSavedRspOffset);    // mov rax, [rsp+saved]
+            EmitGpr(code, 0x8B, 1, kRflagsOffset);
+            Emit(code, { 0x48, 0x89, 0x48, 0x08 });     // mov [rax+8], rcx
+            EmitGpr(code, 0x8B, 1, GprOffset(0));
+            Emit(code, { 0x48, 0x89, 0x08 });           // mov [rax], rcx
+
+            for (int reg = 0; reg < 16; ++reg)
+                if (savesGpr(reg))
+                    EmitGpr(code, 0x8B, reg, GprOffset(reg));
+
+            EmitGpr(code, 0x8B, 4, kSavedRspOffset);    // mov rsp, [rsp+saved]
+            Emit(code, { 0x58 });                       // pop rax
+            Emit(code, { 0x9D });                       // popfq
+            Emit(code, { 0xC3 });                       // ret
+
+            while (code.size() % 8)
+                code.push_back(0xCC);
+
+            stub.destinationSlot = code.size();
+            stub.trampolineSlot = code.size() + 8;
+            code.resize(code.size() + 16, 0x00);
+
+            auto fixup = [&code](std::size_t at, std::size_t slot)
+            {
+                std::int32_t disp = static_cast<std::int32_t>(slot - (at + 4));
+                std::memcpy(&code[at], &disp, sizeof(disp));
+            };
+
+            for (auto at : trampolineFixups)
+                fixup(at, stub.trampolineSlot);
+            for (auto at : destinationFixups)
+                fixup(at, stub.destinationSlot);
+
+            return stub;
+        }
+    }
+
+    class MidHook
+    {
+    public:
+        MidHook() = default;
+        MidHook(const MidHook&) = delete;
+        MidHook(MidHook&& other) noexcept { *this = std::move(other); }
+        MidHook& operator=(const MidHook&) = delete;
+
+        MidHook& operator=(MidHook&& other) noexcept
+        {
+            if (this != &other)
+            {
+                // Remove our hook before the stub it jumps to is released.
+                m_hook = std::move(other.m_hook);
+                m_stub = std::move(other.m_stub);
+            }
+            return *this;
+        }
+
+        explicit operator bool() const { return static_cast<bool>(m_hook); }
+
+        std::uint8_t* target() const { return m_hook.target(); }
+
+        friend MidHook CreateMid(void* target, MidHookFn destination, std::uint64_t regs);
+
+    private:
+        safetyhook::Allocation m_stub{};
+        safetyhook::InlineHook m_hook{};
+    };
+
+    MidHook CreateMid(void* target, MidHookFn destination, std::uint64_t regs)
+    {
+        auto allocator = safetyhook::Allocator::global();
+        auto stub = detail::BuildStub(regs);
+
+        auto allocation = allocator->allocate(stub.code.size());
+        if (!allocation)
+            return {};
+
+        std::copy(stub.code.begin(), stub.code.end(), allocation->data());
+        std::memcpy(allocation->data() + stub.destinationSlot, &destination, sizeof(destination));
+
+        auto inlineHook = safetyhook::InlineHook::create(allocator, target, allocation->data(), safetyhook::InlineHook::StartDisabled);
+        if (!inlineHook)
+            return {};
+
+        auto trampoline = inlineHook->trampoline().data();
+        std::memcpy(allocation->data() + stub.trampolineSlot, &trampoline, sizeof(trampoline));
+
+        if (!inlineHook->enable())
+            return {};
+
+        MidHook hook{};
+        hook.m_stub = std::move(*allocation);
+        hook.m_hook = std::move(*inlineHook);
+        return hook;
+    }
+
+    // Regs is the set of registers the callback reads or writes. Any other Context field is unspecified.
+    template <std::uint64_t Regs, typename T>
+    MidHook CreateMid(T target, MidHookFn destination)
+    {
+        static_assert((Regs & ~kAllRegs) == 0, "Unknown register in lean mid hook register set.");
+        return CreateMid(reinterpret_cast<void*>(target), destination, Regs);
+    }
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include <spdlog/spdlog.h>
+
+// Process memory sampling per scene.
+// Commit, working set and page faults are sampled at every scene transition and on a fixed interval, and written
+// to a CSV tagged with the active settings so the memory cost of tweaks like shadow resolution or LOD can be
+// compared between runs. Scene transitions only sample and queue, the writer thread does all the file IO.
+// On shutdown the last scene is closed and a per-scene summary is appended below the samples.
+namespace MemorySampler
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        std::filesystem::path reportPath;
+        std::chrono::seconds interval{ 10 };
+        std::vector<std::pair<std::string, std::string>> tags;
+    };
+
+    struct Sample
+    {
+        Clock::time_point time;
+        const char* event;
+        std::string scene;
+        std::size_t commit = 0;
+        std::size_t workingSet = 0;
+        std::size_t peakWorkingSet = 0;
+        DWORD pageFaults = 0;
+    };
+
+    // Running peaks for the scene currently on screen, logged when it ends and kept for the summary.
+    struct ScenePeaks
+    {
+        std::string scene;
+        Clock::time_point start;
+        Clock::time_point end;
+        std::size_t commit = 0;
+        std::size_t workingSet = 0;
+        DWORD firstPageFaults = 0;
+        DWORD lastPageFaults = 0;
+        bool sampled = false;
+    };
+
+    Settings settings;
+    Clock::time_point sessionStart;
+    std::atomic<bool> active{ false };
+
+    std::mutex pendingMutex;
+    std::deque<Sample> pending;
+    std::string currentScene;
+
+    // Owned by the writer thread, and by Shutdown once it has taken the lock.
+    std::mutex writerMutex;
+    std::ofstream reportFile;
+    ScenePeaks peaks;
+    DWORD lastPageFaults = 0;
+    std::vector<ScenePeaks> scenes;
+
+    Sample TakeSample(const char* event, std::string scene)
+    {
+        Sample sample{ Clock::now(), event, std::move(scene) };
+
+        PROCESS_MEMORY_COUNTERS_EX pmc{};
+        if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&pmc), sizeof(pmc)))
+        {
+            sample.commit = pmc.PrivateUsage;
+            sample.workingSet = pmc.WorkingSetSize;
+            sample.peakWorkingSet = pmc.PeakWorkingSetSize;
+            sample.pageFaults = pmc.PageFaultCount;
+        }
+        return sample;
+    }
+
+    // Called from the create_config_scene hook on the game's thread.
+    void OnSceneTransition(const std::string& sceneID)
+    {
+        if (!active.load(std::memory_order_relaxed))
+            return;
+
+        auto sample = TakeSample("scene", sceneID);
+
+        std::lock_guard lock(pendingMutex);
+        currentScene = sceneID;
+        pending.push_back(std::move(sample));
+    }
+
+    constexpr double kMB = 1024.0 * 1024.0;
+
+    void CloseScene(Clock::time_point end)
+    {
+        if (!peaks.sampled)
+            return;
+
+        peaks.end = end;
+        double seconds = std::chrono::duration<double>(end - peaks.start).count();
+        spdlog::info("Memory Sampler: Scene \"{}\": {:.1f}s, peak commit {:.1f} MB, peak working set {:.1f} MB, {} page fault(s).",
+            peaks.scene, seconds, peaks.commit / kMB, peaks.workingSet / kMB, peaks.lastPageFaults - peaks.firstPageFaults);
+        scenes.push_back(peaks);
+    }
+
+    void Write(const Sample& sample)
+    {
+        if (std::string_view(sample.event) == "scene")
+        {
+            CloseScene(sample.time);
+            peaks = { sample.scene, sample.time };
+        }
+
+        peaks.commit = std::max(peaks.commit, sample.commit);
+        peaks.workingSet = std::max(peaks.workingSet, sample.workingSet);
+        if (!peaks.sampled)
+            peaks.firstPageFaults = sample.pageFaults;
+        peaks.lastPageFaults = sample.pageFaults;
+        peaks.sampled = true;
+
+        // Page faults are per sample so a spike shows up on the row it happened in.
+        DWORD faults = lastPageFaults ? sample.pageFaults - lastPageFaults : 0;
+        lastPageFaults = sample.pageFaults;
+
+        reportFile << std::format("{:.3f},{},{},{:.1f},{:.1f},{:.1f},{}\n", std::chrono::duration<double>(sample.time - sessionStart).count(), sample.event, sample.scene,
+            sample.commit / kMB, sample.workingSet / kMB, sample.peakWorkingSet / kMB, faults);
+    }
+
+    DWORD __stdcall WriterThread(void*)
+    {
+        auto nextSample = sessionStart + settings.interval;
+        {
+            std::lock_guard lock(writerMutex);
+            reportFile.open(settings.reportPath);
+            if (!reportFile)
+            {
+                spdlog::error("Memory Sampler: Failed to create {}", settings.reportPath.filename().string());
+                active = false;
+                return 0;
+            }
+
+            for (const auto& [name, value] : settings.tags)
+                reportFile << "# " << name << " = " << value << "\n";
+            reportFile << "elapsed_s,event,scene,commit_mb,working_set_mb,peak_working_set_mb,page_faults\n";
+            spdlog::info("Memory Sampler: Writing samples to {}", settings.reportPath.filename().string());
+
+            peaks = { "", sessionStart };
+            Write(TakeSample("start", ""));
+            reportFile.flush();
+        }
+
+        while (true)
+        {
+            Sleep(250);
+
+            std::deque<Sample> samples;
+            std::string scene;
+            {
+                std::lock_guard lock(pendingMutex);
+                samples.swap(pending);
+                scene = currentScene;
+            }
+
+            auto now = Clock::now();
+            if (now >= nextSample)
+            {
+                samples.push_back(TakeSample("interval", scene));
+                nextSample = now + settings.interval;
+            }
+
+            std::lock_guard lock(writerMutex);
+            if (!active)
+                return 0;
+
+            for (const auto& sample : samples)
+                Write(sample);
+            if (!samples.empty())
+                reportFile.flush();
+        }
+        return 0;
+    }
+
+    // Called from DllMain on process detach. Other threads may already be gone, possibly holding a lock,
+    // so nothing here waits.
+    void Shutdown()
+    {
+        std::unique_lock lock(writerMutex, std::try_to_lock);
+        if (!lock || !active || !reportFile.is_open())
+            return;
+        active = false;
+
+        std::unique_lock pendingLock(pendingMutex, std::try_to_lock);
+        if (pendingLock)
+        {
+            for (const auto& sample : pending)
+                Write(sample);
+            pending.clear();
+        }
+
+        auto sample = TakeSample("end", peaks.scene);
+        Write(sample);
+        CloseScene(sample.time);
+
+        reportFile << "\n# Scene summary\n";
+        reportFile << "scene,duration_s,peak_commit_mb,peak_working_set_mb,page_faults\n";
+        for (const auto& scene : scenes)
+        {
+            reportFile << std::format("{},{:.3f},{:.1f},{:.1f},{}\n", scene.scene, std::chrono::duration<double>(scene.end - scene.start).count(),
+                scene.commit / kMB, scene.workingSet / kMB, scene.lastPageFaults - scene.firstPageFaults);
+        }
+        reportFile.flush();
+        spdlog::info("Memory Sampler: Wrote summary of {} scene(s) to {}", scenes.size(), settings.reportPath.filename().string());
+    }
+
+    void Install(const Settings& samplerSettings)
+    {
+        settings = samplerSettings;
+        sessionStart = Clock::now();
+        active = true;
+
+        // Lower the priority before the thread runs so not even its first write competes with the game.
+        HANDLE writerHandle = CreateThread(NULL, 0, WriterThread, 0, CREATE_SUSPENDED, 0);
+        if (!writerHandle)
+        {
+            active = false;
+            return;
+        }
+        SetThreadPriority(writerHandle, THREAD_PRIORITY_BELOW_NORMAL);
+        ResumeThread(writerHandle);
+        CloseHandle(writerHandle);
+    }
+}
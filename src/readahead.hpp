@@ -0,0 +1,293 @@
+#pragma once
+
+#include "stdafx.h"
+#include "helper.hpp"
+#include "blockcache.hpp"
+
+#include <spdlog/spdlog.h>
+
+// Read-ahead for the engine's archive files, built on IAT hooks of the game's file APIs.
+// Synchronous reads on archive handles are tracked per handle. Sequential or strided streams get their next
+// blocks read in the background by BlockCache, and later reads that land in the cache skip the syscall.
+// Overlapped reads are passed straight through since their completions can't be faked for an IOCP.
+namespace ReadAhead
+{
+    struct Settings
+    {
+        std::vector<std::wstring> extensions;
+        BlockCache::Config cache;
+        bool verify = false;
+    };
+
+    // Reads blocks through a second handle so prefetching never moves the game's file pointer.
+    class HandleSource : public BlockCache::Source
+    {
+    public:
+        explicit HandleSource(HANDLE hFile) : m_file(hFile) {}
+
+        std::int64_t Read(std::uint64_t offset, void* buffer, std::size_t size) override
+        {
+            OVERLAPPED overlapped{};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+            DWORD bytesRead = 0;
+            if (!ReadFile(m_file, buffer, static_cast<DWORD>(size), &bytesRead, &overlapped))
+                return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+            return bytesRead;
+        }
+
+    private:
+        HANDLE m_file;
+    };
+
+    struct TrackedHandle
+    {
+        std::uint32_t file;
+        std::uint64_t position = 0;
+        BlockCache::AccessPattern pattern;
+        std::mutex mutex;
+    };
+
+    Settings settings;
+    BlockCache::Cache* cache = nullptr;
+
+    std::shared_mutex handleMutex;
+    std::unordered_map<std::wstring, std::uint32_t> fileIndex;
+    std::unordered_map<HANDLE, std::shared_ptr<TrackedHandle>> handles;
+
+    std::atomic<std::uint64_t> verifiedReads{ 0 };
+    std::atomic<std::uint64_t> verifyMismatches{ 0 };
+
+    // SetFilePointer_Hook seeks through SetFilePointerEx_Hook and ReadAt reads through ReadFile_Fn, so these have to
+    // work even when the game only imports some of the functions.
+    decltype(&CreateFileW) CreateFileW_Fn = CreateFileW;
+    decltype(&ReadFile) ReadFile_Fn = ReadFile;
+    decltype(&SetFilePointerEx) SetFilePointerEx_Fn = SetFilePointerEx;
+    decltype(&SetFilePointer) SetFilePointer_Fn = SetFilePointer;
+    decltype(&CloseHandle) CloseHandle_Fn = CloseHandle;
+
+    bool IsArchive(LPCWSTR lpFileName)
+    {
+        std::wstring_view name(lpFileName);
+        for (const auto& extension : settings.extensions)
+        {
+            if (name.size() >= extension.size() && _wcsicmp(name.data() + name.size() - extension.size(), extension.c_str()) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Shared so a close on another thread can't free the entry while a read or seek still holds its mutex.
+    std::shared_ptr<TrackedHandle> FindHandle(HANDLE hFile)
+    {
+        std::shared_lock lock(handleMutex);
+        auto it = handles.find(hFile);
+        return it != handles.end() ? it->second : nullptr;
+    }
+
+    // Positioned read on a synchronous handle. Unlike a plain ReadFile these report end of file as an error.
+    BOOL ReadAt(HANDLE hFile, std::uint64_t offset, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead)
+    {
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        BOOL result = ReadFile_Fn(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, &overlapped);
+        if (!result && GetLastError() == ERROR_HANDLE_EOF)
+        {
+            *lpNumberOfBytesRead = 0;
+            SetLastError(ERROR_SUCCESS);
+            return TRUE;
+        }
+        return result;
+    }
+
+    HANDLE WINAPI CreateFileW_Hook(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+    {
+        HANDLE hFile = CreateFileW_Fn(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+        if (hFile == INVALID_HANDLE_VALUE || !lpFileName || (dwDesiredAccess & GENERIC_WRITE) || (dwFlagsAndAttributes & FILE_FLAG_OVERLAPPED) || !IsArchive(lpFileName))
+            return hFile;
+
+        DWORD lastError = GetLastError();
+        std::unique_lock lock(handleMutex);
+
+        auto it = fileIndex.find(lpFileName);
+        if (it == fileIndex.end())
+        {
+            HANDLE hSource = CreateFileW(lpFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (hSource == INVALID_HANDLE_VALUE)
+            {
+                SetLastError(lastError);
+                return hFile;
+            }
+
+            it = fileIndex.emplace(lpFileName, cache->AddFile(std::make_shared<HandleSource>(hSource))).first;
+            spdlog::info("Read Ahead: Tracking {}", Util::wstring_to_string(lpFileName));
+        }
+
+        auto tracked = std::make_shared<TrackedHandle>();
+        tracked->file = it->second;
+        handles[hFile] = std::move(tracked);
+
+        SetLastError(lastError);
+        return hFile;
+    }
+
+    BOOL WINAPI CloseHandle_Hook(HANDLE hObject)
+    {
+        if (FindHandle(hObject))
+        {
+            std::unique_lock lock(handleMutex);
+            handles.erase(hObject);
+        }
+        return CloseHandle_Fn(hObject);
+    }
+
+    BOOL WINAPI SetFilePointerEx_Hook(HANDLE hFile, LARGE_INTEGER liDistanceToMove, PLARGE_INTEGER lpNewFilePointer, DWORD dwMoveMethod)
+    {
+        auto tracked = FindHandle(hFile);
+        if (!tracked)
+            return SetFilePointerEx_Fn(hFile, liDistanceToMove, lpNewFilePointer, dwMoveMethod);
+
+        std::lock_guard lock(tracked->mutex);
+
+        LARGE_INTEGER newPosition{};
+        BOOL result = SetFilePointerEx_Fn(hFile, liDistanceToMove, &newPosition, dwMoveMethod);
+        if (result)
+        {
+            tracked->position = static_cast<std::uint64_t>(newPosition.QuadPart);
+            if (lpNewFilePointer)
+                *lpNewFilePointer = newPosition;
+        }
+        return result;
+    }
+
+    DWORD WINAPI SetFilePointer_Hook(HANDLE hFile, LONG lDistanceToMove, PLONG lpDistanceToMoveHigh, DWORD dwMoveMethod)
+    {
+        auto tracked = FindHandle(hFile);
+        if (!tracked)
+            return SetFilePointer_Fn(hFile, lDistanceToMove, lpDistanceToMoveHigh, dwMoveMethod);
+
+        LARGE_INTEGER distance{};
+        if (lpDistanceToMoveHigh)
+        {
+            distance.LowPart = static_cast<DWORD>(lDistanceToMove);
+            distance.HighPart = *lpDistanceToMoveHigh;
+        }
+        else
+        {
+            distance.QuadPart = lDistanceToMove;
+        }
+
+        LARGE_INTEGER newPosition{};
+        if (!SetFilePointerEx_Hook(hFile, distance, &newPosition, dwMoveMethod))
+            return INVALID_SET_FILE_POINTER;
+
+        if (lpDistanceToMoveHigh)
+            *lpDistanceToMoveHigh = newPosition.HighPart;
+        SetLastError(ERROR_SUCCESS);
+        return newPosition.LowPart;
+    }
+
+    BOOL WINAPI ReadFile_Hook(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+    {
+        auto tracked = FindHandle(hFile);
+        if (!tracked || !lpNumberOfBytesRead)
+            return ReadFile_Fn(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+
+        std::lock_guard lock(tracked->mutex);
+
+        // Positioned read on a synchronous handle, let it through but keep our position in step.
+        if (lpOverlapped)
+        {
+            BOOL result = ReadFile_Fn(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+            if (result)
+                tracked->position = ((static_cast<std::uint64_t>(lpOverlapped->OffsetHigh) << 32) | lpOverlapped->Offset) + *lpNumberOfBytesRead;
+            return result;
+        }
+
+        std::uint64_t offset = tracked->position;
+        for (const auto& range : tracked->pattern.Observe(offset, nNumberOfBytesToRead, settings.cache))
+            cache->Prefetch(tracked->file, range.offset, range.size);
+
+        if (auto cached = cache->Read(tracked->file, offset, lpBuffer, nNumberOfBytesToRead))
+        {
+            *lpNumberOfBytesRead = static_cast<DWORD>(*cached);
+
+            if (settings.verify)
+            {
+                // Compare against a real read and hand the game the real data if they disagree.
+                std::vector<std::uint8_t> expected(nNumberOfBytesToRead);
+                DWORD expectedBytes = 0;
+                if (ReadAt(hFile, offset, expected.data(), nNumberOfBytesToRead, &expectedBytes))
+                {
+                    verifiedReads++;
+                    if (expectedBytes != *cached || std::memcmp(expected.data(), lpBuffer, expectedBytes) != 0)
+                    {
+                        verifyMismatches++;
+                        spdlog::error("Read Ahead: Verify: Mismatch at 0x{:x} ({} bytes, cache returned {}).", offset, expectedBytes, *cached);
+                        std::memcpy(lpBuffer, expected.data(), expectedBytes);
+                        *lpNumberOfBytesRead = expectedBytes;
+                    }
+                }
+            }
+
+            // A hit never reached the file, so move the real file pointer past the data like the read would have.
+            // Reads and seeks from other modules go to the handle directly, so it has to agree with our position.
+            tracked->position = offset + *lpNumberOfBytesRead;
+            LARGE_INTEGER newPosition{};
+            newPosition.QuadPart = static_cast<LONGLONG>(tracked->position);
+            SetFilePointerEx_Fn(hFile, newPosition, nullptr, FILE_BEGIN);
+            SetLastError(ERROR_SUCCESS);
+            return TRUE;
+        }
+
+        BOOL result = ReadAt(hFile, offset, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead);
+        if (result)
+            tracked->position = offset + *lpNumberOfBytesRead;
+        return result;
+    }
+
+    void LogStats()
+    {
+        static BlockCache::Stats last{};
+        auto stats = cache->GetStats();
+        if (stats.hits == last.hits && stats.misses == last.misses)
+            return;
+
+        double hitRate = 100.0 * stats.hits / std::max<std::uint64_t>(stats.hits + stats.misses, 1);
+        spdlog::info("Read Ahead: {} hit(s), {} miss(es) ({:.1f}% hit rate), {:.2f} MB served from cache.", stats.hits, stats.misses, hitRate, stats.bytesServed / (1024.0 * 1024.0));
+        spdlog::info("Read Ahead: {} block(s) prefetched, {} evicted, {} failed.", stats.blocksPrefetched, stats.blocksEvicted, stats.prefetchFailures);
+        if (settings.verify)
+            spdlog::info("Read Ahead: Verify: {} read(s) checked, {} mismatch(es).", verifiedReads.load(), verifyMismatches.load());
+        last = stats;
+    }
+
+    void Install(HMODULE module, const Settings& readAheadSettings)
+    {
+        settings = readAheadSettings;
+
+        if (!Memory::IsImported(module, "kernel32.dll", "CreateFileW") || !Memory::IsImported(module, "kernel32.dll", "ReadFile"))
+        {
+            spdlog::error("Read Ahead: CreateFileW/ReadFile aren't imported, read-ahead disabled.");
+            return;
+        }
+
+        // Never freed, the prefetch thread may still be running when the process exits.
+        cache = new BlockCache::Cache(settings.cache);
+
+        std::vector<Memory::IATHook> hooks = {
+            Memory::MakeIATHook("kernel32.dll", "CreateFileW", &CreateFileW_Hook, CreateFileW_Fn),
+            Memory::MakeIATHook("kernel32.dll", "ReadFile", &ReadFile_Hook, ReadFile_Fn),
+            Memory::MakeIATHook("kernel32.dll", "SetFilePointerEx", &SetFilePointerEx_Hook, SetFilePointerEx_Fn),
+            Memory::MakeIATHook("kernel32.dll", "SetFilePointer", &SetFilePointer_Hook, SetFilePointer_Fn),
+            Memory::MakeIATHook("kernel32.dll", "CloseHandle", &CloseHandle_Hook, CloseHandle_Fn)
+        };
+        Memory::HookIATBatch(module, hooks);
+        for (const auto& hook : hooks)
+            spdlog::info("Read Ahead: {}: {}", hook.function, hook.hooked ? "Hooked." : "Not imported.");
+
+        Util::run_periodically(std::chrono::minutes(1), LogStats);
+    }
+}
@@ -0,0 +1,541 @@
+#pragma once
+
+#include "stdafx.h"
+#include "helper.hpp"
+
+#include <safetyhook.hpp>
+#include <spdlog/spdlog.h>
+
+// Thread-caching size-class allocator that can stand in for the game's process heap and CRT heap imports.
+// Small blocks come from one reserved arena, carved into 64 KB units that each hold a single size class.
+// Each thread keeps its own free lists and only takes a per-class lock to move a batch of blocks in or out.
+// Only the game's own allocations are redirected, through its IAT. Arena blocks can be handed to any module
+// though, so the freeing side is inline hooked in ntdll where every heap and CRT free, realloc and size query
+// in the process ends up. Anything outside the arena (allocations made before the switch, large blocks, other
+// heaps) is handed back to the original functions, so ownership is decided purely by address.
+namespace ScalableHeap
+{
+    struct Settings
+    {
+        std::size_t arenaSize = 4096ull * 1024 * 1024;
+    };
+
+    constexpr std::size_t kUnitSize = 64 * 1024;
+    constexpr std::size_t kMaxBlockSize = 32 * 1024;
+    constexpr std::size_t kClassCount = 40;
+    constexpr std::uint32_t kFlushInterval = 4096;
+    constexpr std::size_t kGranule = 16;    // Every size class is a multiple of this, so blocks start on it
+
+    // 16 byte steps up to 128, then four steps per power of two up to kMaxBlockSize.
+    constexpr std::size_t ClassSize(std::size_t index)
+    {
+        if (index < 8)
+            return (index + 1) * 16;
+        std::size_t bits = 8 + (index - 8) / 4;
+        return (5 + (index - 8) % 4) << (bits - 3);
+    }
+
+    constexpr std::size_t ClassIndex(std::size_t size)
+    {
+        if (size <= 128)
+            return size ? (size - 1) >> 4 : 0;
+        std::size_t bits = std::bit_width(size - 1);
+        return 8 + (bits - 8) * 4 + (((size - 1) >> (bits - 3)) & 3);
+    }
+
+    static_assert(ClassSize(kClassCount - 1) == kMaxBlockSize && ClassIndex(kMaxBlockSize) == kClassCount - 1);
+    static_assert(ClassIndex(129) == 8 && ClassSize(8) == 160 && ClassIndex(256) == 11 && ClassSize(11) == 256);
+    static_assert(kMaxBlockSize <= UINT16_MAX && kUnitSize / kGranule * sizeof(std::uint16_t) % 4096 == 0);
+
+    // Blocks moved between a thread and the shared lists at once.
+    constexpr std::uint32_t BatchSize(std::size_t index)
+    {
+        return static_cast<std::uint32_t>(std::clamp<std::size_t>(kUnitSize / ClassSize(index), 4, 64));
+    }
+
+    // Units carved at once for a class, enough for a few batches of the larger classes.
+    constexpr std::size_t RunUnits(std::size_t index)
+    {
+        return std::max<std::size_t>(1, ClassSize(index) * 8 / kUnitSize);
+    }
+
+    struct Block
+    {
+        Block* next;
+    };
+
+    struct FreeList
+    {
+        Block* head = nullptr;
+        std::uint32_t count = 0;
+    };
+
+    struct alignas(64) CentralList
+    {
+        std::mutex mutex;
+        FreeList list;
+    };
+
+    struct Stats
+    {
+        std::atomic<std::uint64_t> allocs{ 0 };
+        std::atomic<std::uint64_t> frees{ 0 };
+        std::atomic<std::uint64_t> reallocs{ 0 };
+        std::atomic<std::uint64_t> fallbackAllocs{ 0 };
+        std::atomic<std::uint64_t> transfers{ 0 };
+        std::atomic<std::uint64_t> contended{ 0 };
+        std::atomic<std::uint64_t> committed{ 0 };
+    };
+
+    std::uint8_t* arenaBase = nullptr;
+    std::size_t arenaSize = 0;
+    std::size_t arenaNextUnit = 0;
+    std::mutex arenaMutex;
+    std::vector<std::uint8_t> unitClass;
+    std::uint16_t* requestedSizes = nullptr;    // Size asked for, per granule of the arena, committed alongside it
+    std::array<CentralList, kClassCount> central;
+    HANDLE processHeap = nullptr;
+    Stats stats;
+
+    bool Owns(const void* ptr)
+    {
+        return static_cast<std::size_t>(static_cast<const std::uint8_t*>(ptr) - arenaBase) < arenaSize;
+    }
+
+    // Usable size of the block, what the size class rounds up to.
+    std::size_t BlockSize(const void* ptr)
+    {
+        return ClassSize(unitClass[(static_cast<const std::uint8_t*>(ptr) - arenaBase) / kUnitSize]);
+    }
+
+    // What HeapSize and _msize report, the size the block was last allocated or resized to.
+    std::size_t RequestedSize(const void* ptr)
+    {
+        return requestedSizes[(static_cast<const std::uint8_t*>(ptr) - arenaBase) / kGranule];
+    }
+
+    void SetRequestedSize(const void* ptr, std::size_t size)
+    {
+        requestedSizes[(static_cast<const std::uint8_t*>(ptr) - arenaBase) / kGranule] = static_cast<std::uint16_t>(size);
+    }
+
+    void LockCentral(CentralList& list)
+    {
+        if (!list.mutex.try_lock())
+        {
+            stats.contended.fetch_add(1, std::memory_order_relaxed);
+            list.mutex.lock();
+        }
+        stats.transfers.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Commits a new run of units for a class and threads it into a free list.
+    FreeList CarveRun(std::size_t index)
+    {
+        const std::size_t units = RunUnits(index);
+
+        std::uint8_t* run = nullptr;
+        {
+            std::lock_guard lock(arenaMutex);
+            if ((arenaNextUnit + units) * kUnitSize > arenaSize)
+                return {};
+            if (!VirtualAlloc(arenaBase + arenaNextUnit * kUnitSize, units * kUnitSize, MEM_COMMIT, PAGE_READWRITE) ||
+                !VirtualAlloc(requestedSizes + arenaNextUnit * (kUnitSize / kGranule), units * (kUnitSize / kGranule) * sizeof(std::uint16_t), MEM_COMMIT, PAGE_READWRITE))
+                return {};
+
+            run = arenaBase + arenaNextUnit * kUnitSize;
+            std::fill_n(unitClass.begin() + arenaNextUnit, units, static_cast<std::uint8_t>(index));
+            arenaNextUnit += units;
+        }
+        stats.committed.fetch_add(units * kUnitSize, std::memory_order_relaxed);
+
+        FreeList list{};
+        const std::size_t size = ClassSize(index);
+        for (std::size_t offset = (units * kUnitSize / size - 1) * size;; offset -= size)
+        {
+            auto* block = reinterpret_cast<Block*>(run + offset);
+            block->next = list.head;
+            list.head = block;
+            list.count++;
+            if (offset == 0)
+                break;
+        }
+        return list;
+    }
+
+    // Set when this thread's cache is built and when it's destroyed. Frees can still arrive after that during thread
+    // teardown, from other modules' TLS destructors or DLL_THREAD_DETACH, and have to go straight to the shared lists.
+    // Touching threadCache then would build a fresh cache whose destructor never runs, so only allocations build one.
+    thread_local bool threadCacheBuilt = false;
+    thread_local bool threadCacheDestroyed = false;
+
+    struct ThreadCache
+    {
+        std::array<FreeList, kClassCount> lists{};
+        std::uint64_t allocs = 0;
+        std::uint64_t frees = 0;
+        std::uint32_t ops = 0;
+
+        ThreadCache() { threadCacheBuilt = true; }
+
+        ~ThreadCache()
+        {
+            for (std::size_t index = 0; index < kClassCount; ++index)
+                Drain(index, lists[index].count);
+            Flush();
+            threadCacheDestroyed = true;
+        }
+
+        void Flush()
+        {
+            stats.allocs.fetch_add(allocs, std::memory_order_relaxed);
+            stats.frees.fetch_add(frees, std::memory_order_relaxed);
+            allocs = frees = 0;
+        }
+
+        void Count()
+        {
+            if (++ops % kFlushInterval == 0)
+                Flush();
+        }
+
+        bool Refill(std::size_t index)
+        {
+            auto& shared = central[index];
+            auto& list = lists[index];
+            const std::uint32_t batch = BatchSize(index);
+
+            LockCentral(shared);
+            while (shared.list.head && list.count < batch)
+            {
+                Block* block = shared.list.head;
+                shared.list.head = block->next;
+                shared.list.count--;
+                block->next = list.head;
+                list.head = block;
+                list.count++;
+            }
+            shared.mutex.unlock();
+
+            if (list.head)
+                return true;
+
+            // Keep one batch here and give the rest of a fresh run to the shared list.
+            FreeList run = CarveRun(index);
+            if (!run.head)
+                return false;
+
+            Block* tail = run.head;
+            for (std::uint32_t i = 1; i < batch && tail->next; ++i)
+                tail = tail->next;
+
+            list.head = run.head;
+            list.count = std::min(batch, run.count);
+            Block* rest = tail->next;
+            tail->next = nullptr;
+
+            if (rest)
+            {
+                Block* last = rest;
+                while (last->next)
+                    last = last->next;
+
+                LockCentral(shared);
+                last->next = shared.list.head;
+                shared.list.head = rest;
+                shared.list.count += run.count - list.count;
+                shared.mutex.unlock();
+            }
+            return true;
+        }
+
+        void Drain(std::size_t index, std::uint32_t count)
+        {
+            auto& list = lists[index];
+            if (!count || !list.head)
+                return;
+
+            Block* head = list.head;
+            Block* tail = head;
+            std::uint32_t moved = 1;
+            for (; moved < count && tail->next; ++moved)
+                tail = tail->next;
+
+            list.head = tail->next;
+            list.count -= moved;
+
+            auto& shared = central[index];
+            LockCentral(shared);
+            tail->next = shared.list.head;
+            shared.list.head = head;
+            shared.list.count += moved;
+            shared.mutex.unlock();
+        }
+    };
+
+    thread_local ThreadCache threadCache;
+
+    // Returns nullptr when the block is too large or the arena is full, the caller then uses the original heap.
+    void* Allocate(std::size_t size, bool zero)
+    {
+        if (size > kMaxBlockSize || threadCacheDestroyed)
+            return nullptr;
+
+        const std::size_t index = ClassIndex(size);
+        auto& cache = threadCache;
+        auto& list = cache.lists[index];
+        if (!list.head && !cache.Refill(index))
+            return nullptr;
+
+        Block* block = list.head;
+        list.head = block->next;
+        list.count--;
+
+        cache.allocs++;
+        cache.Count();
+
+        if (zero)
+            std::memset(block, 0, ClassSize(index));
+        SetRequestedSize(block, size);
+        return block;
+    }
+
+    void Free(void* ptr)
+    {
+        const std::size_t index = unitClass[(static_cast<std::uint8_t*>(ptr) - arenaBase) / kUnitSize];
+        auto* block = static_cast<Block*>(ptr);
+
+        if (!threadCacheBuilt || threadCacheDestroyed)
+        {
+            auto& shared = central[index];
+            LockCentral(shared);
+            block->next = shared.list.head;
+            shared.list.head = block;
+            shared.list.count++;
+            shared.mutex.unlock();
+            stats.frees.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& cache = threadCache;
+        auto& list = cache.lists[index];
+
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+
+        if (list.count > BatchSize(index) * 2)
+            cache.Drain(index, BatchSize(index));
+
+        cache.frees++;
+        cache.Count();
+    }
+
+    // Resizes an arena block. Stays in place while the new size still fits and isn't wastefully small.
+    template <typename Fallback>
+    void* Reallocate(void* ptr, std::size_t size, bool zero, Fallback&& fallback)
+    {
+        stats.reallocs.fetch_add(1, std::memory_order_relaxed);
+
+        const std::size_t oldSize = RequestedSize(ptr);
+        const std::size_t blockSize = BlockSize(ptr);
+        if (size <= blockSize && size > blockSize / 2)
+        {
+            if (zero && size > oldSize)
+                std::memset(static_cast<std::uint8_t*>(ptr) + oldSize, 0, size - oldSize);
+            SetRequestedSize(ptr, size);
+            return ptr;
+        }
+
+        void* newPtr = Allocate(size, false);
+        if (!newPtr)
+        {
+            newPtr = fallback(size);
+            if (!newPtr)
+                return nullptr;
+            stats.fallbackAllocs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::memcpy(newPtr, ptr, std::min(oldSize, size));
+        if (zero && size > oldSize)
+            std::memset(static_cast<std::uint8_t*>(newPtr) + oldSize, 0, size - oldSize);
+
+        Free(ptr);
+        return newPtr;
+    }
+
+    // Reallocations fall back to HeapAlloc_Fn whether or not the game imports HeapAlloc itself.
+    decltype(&HeapAlloc) HeapAlloc_Fn = HeapAlloc;
+
+    // Only set once hooked, the game's CRT may not be the one this plugin links.
+    decltype(&malloc) malloc_Fn = nullptr;
+    decltype(&calloc) calloc_Fn = nullptr;
+
+    // Inline hooks on ntdll's RtlFreeHeap, RtlReAllocateHeap and RtlSizeHeap. HeapFree, HeapReAlloc and HeapSize
+    // are forwarded straight to them, and the CRT's free, realloc, _recalloc, _expand and _msize sit on top of those.
+    SafetyHookInline HeapFreeHook{};
+    SafetyHookInline HeapReAllocHook{};
+    SafetyHookInline HeapSizeHook{};
+
+    LPVOID WINAPI HeapAlloc_Hook(HANDLE hHeap, DWORD dwFlags, SIZE_T dwBytes)
+    {
+        // Private heaps can be destroyed wholesale, so only the process heap is substituted.
+        if (hHeap == processHeap)
+        {
+            if (void* ptr = Allocate(dwBytes, dwFlags & HEAP_ZERO_MEMORY))
+                return ptr;
+            stats.fallbackAllocs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return HeapAlloc_Fn(hHeap, dwFlags, dwBytes);
+    }
+
+    BOOL WINAPI HeapFree_Hook(HANDLE hHeap, DWORD dwFlags, LPVOID lpMem)
+    {
+        if (lpMem && Owns(lpMem))
+        {
+            Free(lpMem);
+            return TRUE;
+        }
+        return HeapFreeHook.unsafe_stdcall<BOOL>(hHeap, dwFlags, lpMem);
+    }
+
+    LPVOID WINAPI HeapReAlloc_Hook(HANDLE hHeap, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes)
+    {
+        if (!lpMem || !Owns(lpMem))
+            return HeapReAllocHook.unsafe_stdcall<LPVOID>(hHeap, dwFlags, lpMem, dwBytes);
+
+        if (dwFlags & HEAP_REALLOC_IN_PLACE_ONLY)
+        {
+            if (dwBytes <= BlockSize(lpMem))
+            {
+                std::size_t oldSize = RequestedSize(lpMem);
+                if ((dwFlags & HEAP_ZERO_MEMORY) && dwBytes > oldSize)
+                    std::memset(static_cast<std::uint8_t*>(lpMem) + oldSize, 0, dwBytes - oldSize);
+                SetRequestedSize(lpMem, dwBytes);
+                return lpMem;
+            }
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return nullptr;
+        }
+
+        void* ptr = Reallocate(lpMem, dwBytes, dwFlags & HEAP_ZERO_MEMORY, [&](std::size_t size) { return HeapAlloc_Fn(processHeap, dwFlags & HEAP_ZERO_MEMORY, size); });
+        if (!ptr)
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return ptr;
+    }
+
+    SIZE_T WINAPI HeapSize_Hook(HANDLE hHeap, DWORD dwFlags, LPCVOID lpMem)
+    {
+        if (lpMem && Owns(lpMem))
+            return RequestedSize(lpMem);
+        return HeapSizeHook.unsafe_stdcall<SIZE_T>(hHeap, dwFlags, lpMem);
+    }
+
+    void* __cdecl malloc_Hook(size_t size)
+    {
+        if (void* ptr = Allocate(size, false))
+            return ptr;
+        stats.fallbackAllocs.fetch_add(1, std::memory_order_relaxed);
+        return malloc_Fn(size);
+    }
+
+    void* __cdecl calloc_Hook(size_t count, size_t size)
+    {
+        if (!count || size <= SIZE_MAX / count)
+        {
+            if (void* ptr = Allocate(count * size, true))
+                return ptr;
+        }
+        stats.fallbackAllocs.fetch_add(1, std::memory_order_relaxed);
+        return calloc_Fn(count, size);
+    }
+
+    void LogStats()
+    {
+        // Frees and allocs are batched per thread, so these trail the true counts slightly.
+        static std::uint64_t lastTransfers = 0;
+        auto transfers = stats.transfers.load();
+        if (transfers == lastTransfers)
+            return;
+
+        auto contended = stats.contended.load();
+        spdlog::info("Scalable Heap: {} alloc(s), {} free(s), {} realloc(s), {:.1f} MB committed.", stats.allocs.load(), stats.frees.load(), stats.reallocs.load(), stats.committed.load() / (1024.0 * 1024.0));
+        spdlog::info("Scalable Heap: {} fallback alloc(s) passed to the original heap.", stats.fallbackAllocs.load());
+        spdlog::info("Scalable Heap: {} batch transfer(s), {} contended ({:.2f}%).", transfers, contended, 100.0 * contended / std::max<std::uint64_t>(transfers, 1));
+        lastTransfers = transfers;
+    }
+
+    void LogHooks(const std::vector<Memory::IATHook>& hooks)
+    {
+        for (const auto& hook : hooks)
+            spdlog::info("Scalable Heap: {}!{}: {}", hook.module, hook.function, hook.hooked ? "Hooked." : "Not imported.");
+    }
+
+    void Install(HMODULE module, const Settings& heapSettings)
+    {
+        arenaSize = heapSettings.arenaSize & ~(kUnitSize - 1);
+        arenaBase = static_cast<std::uint8_t*>(VirtualAlloc(nullptr, arenaSize, MEM_RESERVE, PAGE_READWRITE));
+        requestedSizes = static_cast<std::uint16_t*>(VirtualAlloc(nullptr, arenaSize / kGranule * sizeof(std::uint16_t), MEM_RESERVE, PAGE_READWRITE));
+        if (!arenaBase || !requestedSizes)
+        {
+            spdlog::error("Scalable Heap: Failed to reserve a {} MB arena.", arenaSize / (1024 * 1024));
+            if (arenaBase)
+                VirtualFree(arenaBase, 0, MEM_RELEASE);
+            arenaBase = nullptr;
+            arenaSize = 0;
+            return;
+        }
+        unitClass.assign(arenaSize / kUnitSize, 0);
+        processHeap = GetProcessHeap();
+        spdlog::info("Scalable Heap: Reserved {} MB arena at {:p}.", arenaSize / (1024 * 1024), static_cast<void*>(arenaBase));
+
+        // The freeing side goes in first so every arena block already has a way back once allocations start.
+        // Without all three an arena block could reach the real heap from some module, so nothing is substituted.
+        HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+        void* rtlFreeHeap = ntdll ? reinterpret_cast<void*>(GetProcAddress(ntdll, "RtlFreeHeap")) : nullptr;
+        void* rtlReAllocateHeap = ntdll ? reinterpret_cast<void*>(GetProcAddress(ntdll, "RtlReAllocateHeap")) : nullptr;
+        void* rtlSizeHeap = ntdll ? reinterpret_cast<void*>(GetProcAddress(ntdll, "RtlSizeHeap")) : nullptr;
+        // The detours call through these globals, and safetyhook frees memory of its own while hooking, so every
+        // hook is stored before any of them is switched on.
+        if (rtlFreeHeap && rtlReAllocateHeap && rtlSizeHeap)
+        {
+            HeapFreeHook = safetyhook::create_inline(rtlFreeHeap, reinterpret_cast<void*>(HeapFree_Hook), SafetyHookInline::StartDisabled);
+            HeapReAllocHook = safetyhook::create_inline(rtlReAllocateHeap, reinterpret_cast<void*>(HeapReAlloc_Hook), SafetyHookInline::StartDisabled);
+            HeapSizeHook = safetyhook::create_inline(rtlSizeHeap, reinterpret_cast<void*>(HeapSize_Hook), SafetyHookInline::StartDisabled);
+        }
+
+        bool hooked = HeapFreeHook && HeapReAllocHook && HeapSizeHook;
+        hooked = hooked && HeapFreeHook.enable() && HeapReAllocHook.enable() && HeapSizeHook.enable();
+        if (!hooked)
+        {
+            // Nothing has reached the arena yet. Unhook before the hooks are destroyed so no thread is still
+            // inside a trampoline when it's freed.
+            spdlog::error("Scalable Heap: Failed to hook RtlFreeHeap/RtlReAllocateHeap/RtlSizeHeap, heap substitution disabled.");
+            for (auto* hook : { &HeapFreeHook, &HeapReAllocHook, &HeapSizeHook })
+            {
+                if (*hook)
+                    (void)hook->disable();
+            }
+            HeapFreeHook = {};
+            HeapReAllocHook = {};
+            HeapSizeHook = {};
+            return;
+        }
+        spdlog::info("Scalable Heap: Hooked RtlFreeHeap, RtlReAllocateHeap and RtlSizeHeap.");
+
+        std::vector<Memory::IATHook> hooks = { Memory::MakeIATHook("kernel32.dll", "HeapAlloc", &HeapAlloc_Hook, HeapAlloc_Fn) };
+        for (const char* crtModule : { "api-ms-win-crt-heap-l1-1-0.dll", "ucrtbase.dll", "msvcrt.dll" })
+        {
+            if (Memory::IsImported(module, crtModule, "malloc"))
+            {
+                hooks.push_back(Memory::MakeIATHook(crtModule, "malloc", &malloc_Hook, malloc_Fn));
+                hooks.push_back(Memory::MakeIATHook(crtModule, "calloc", &calloc_Hook, calloc_Fn));
+                break;
+            }
+        }
+        Memory::HookIATBatch(module, hooks);
+        LogHooks(hooks);
+
+        Util::run_periodically(std::chrono::minutes(1), LogStats);
+    }
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Precompiled signature pack.
+// A pack holds compiled byte/mask patterns that stand in for built-in signatures, keyed by a hash of the built-in
+// pattern, plus a serialized anchor table so every pattern can be matched in one pass over the module.
+// Nothing in here touches Windows so the offline tool in tools/sigpack can build and check packs anywhere.
+namespace SigPack
+{
+    constexpr std::uint32_t kMagic = 0x50535444; // "DTSP"
+    constexpr std::uint32_t kVersion = 2;
+    constexpr std::uint32_t kBucketCount = 1 << 16;
+    constexpr std::uint32_t kAllGames = 0xFFFFFFFF;
+
+    // Bit n of a pattern's game mask is Game value n in dllmain.cpp.
+    constexpr std::array<const char*, 9> kGameNames = { "Unknown", "OgreF", "Lexus2", "Judge", "Yazawa", "Coyote", "Aston", "Elvis", "Sparrow" };
+
+    // All fields are little-endian, offsets are from the start of the file.
+    struct Header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t fileSize;
+        std::uint32_t checksum;         // FNV-1a over everything after the header
+        std::uint32_t patternCount;
+        std::uint32_t patternsOffset;   // PatternRecord[patternCount], sorted by key
+        std::uint32_t bytesOffset;      // Value bytes then mask bytes for each pattern
+        std::uint32_t bytesSize;
+        std::uint32_t bucketsOffset;    // std::uint32_t[kBucketCount + 1], first entry of each anchor bucket
+        std::uint32_t entriesOffset;    // std::uint32_t[entryCount], pattern indices grouped by anchor
+        std::uint32_t entryCount;
+        std::uint32_t reserved;
+    };
+
+    struct PatternRecord
+    {
+        std::uint64_t key;      // Key() of the built-in pattern this entry replaces
+        std::uint32_t games;    // Games the entry applies to
+        std::int32_t offset;    // Added to each match so it lands where the built-in pattern's match would
+        std::uint32_t bytes;    // Offset into the bytes blob
+        std::uint16_t length;   // 0 marks the built-in pattern as absent from these games' builds, see Absent()
+        std::uint16_t anchor;   // Offset of the two literal bytes used to bucket this pattern
+    };
+
+    static_assert(sizeof(Header) == 48 && sizeof(PatternRecord) == 24);
+
+    struct Pattern
+    {
+        std::vector<std::uint8_t> values;
+        std::vector<std::uint8_t> masks;    // 0xFF must match, 0x00 wildcard
+    };
+
+    // Parses "48 8B ?? ?? E8" style signatures. Returns nothing if the text isn't a signature.
+    std::optional<Pattern> Parse(std::string_view text)
+    {
+        Pattern pattern;
+        std::size_t i = 0;
+        while (i < text.size())
+        {
+            if (std::isspace(static_cast<unsigned char>(text[i])))
+            {
+                ++i;
+                continue;
+            }
+
+            if (text[i] == '?')
+            {
+                i += (i + 1 < text.size() && text[i + 1] == '?') ? 2 : 1;
+                pattern.values.push_back(0);
+                pattern.masks.push_back(0x00);
+                continue;
+            }
+
+            if (i + 1 >= text.size() || !std::isxdigit(static_cast<unsigned char>(text[i])) || !std::isxdigit(static_cast<unsigned char>(text[i + 1])))
+                return std::nullopt;
+
+            pattern.values.push_back(static_cast<std::uint8_t>(std::stoul(std::string(text.substr(i, 2)), nullptr, 16)));
+            pattern.masks.push_back(0xFF);
+            i += 2;
+        }
+
+        if (pattern.values.empty())
+            return std::nullopt;
+        return pattern;
+    }
+
+    std::uint32_t Fnv1a32(const std::uint8_t* data, std::size_t size)
+    {
+        std::uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < size; ++i)
+            hash = (hash ^ data[i]) * 16777619u;
+        return hash;
+    }
+
+    // Identifies a built-in signature regardless of spacing or how its wildcards are written.
+    std::uint64_t Key(const Pattern& pattern)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (std::size_t i = 0; i < pattern.values.size(); ++i)
+        {
+            std::uint32_t token = pattern.masks[i] ? pattern.values[i] : 0x100;
+            for (int b = 0; b < 2; ++b)
+                hash = (hash ^ ((token >> (b * 8)) & 0xFF)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::optional<std::uint64_t> Key(std::string_view text)
+    {
+        auto pattern = Parse(text);
+        if (!pattern)
+            return std::nullopt;
+        return Key(*pattern);
+    }
+
+    struct Anchor
+    {
+        std::uint16_t offset;
+        bool pair;  // Both bytes are literal, otherwise only the first one is
+    };
+
+    // Picks the literal bytes least likely to be common in x64 code, preferring two adjacent literals.
+    // Patterns with no adjacent literals fall back to a single byte, which costs a slot in 256 buckets.
+    std::optional<Anchor> ChooseAnchor(const Pattern& pattern)
+    {
+        auto commonness = [](std::uint8_t value)
+        {
+            switch (value)
+            {
+            case 0x00: case 0xFF: case 0xCC: case 0x48: case 0x8B: case 0x89: case 0x4C: case 0x0F: case 0x90:
+                return 2;
+            case 0x24: case 0x44: case 0x8D: case 0xE8: case 0xC5:
+                return 1;
+            default:
+                return 0;
+            }
+        };
+
+        std::optional<Anchor> best;
+        int bestScore = 0;
+        for (std::size_t i = 0; i + 1 < pattern.values.size(); ++i)
+        {
+            if (!pattern.masks[i])
+                continue;
+
+            bool pair = pattern.masks[i + 1] != 0;
+            int score = commonness(pattern.values[i]) + (pair ? commonness(pattern.values[i + 1]) : 10);
+            if (!best || score < bestScore)
+            {
+                best = Anchor{ static_cast<std::uint16_t>(i), pair };
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    struct Entry
+    {
+        std::uint64_t key;
+        std::uint32_t games;
+        std::int32_t offset;
+        Pattern pattern;    // Empty for an absent entry
+    };
+
+    template <typename T>
+    void Append(std::vector<std::uint8_t>& out, const T& value)
+    {
+        const auto* bytes = reinterpret_cast<const std::uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Serializes entries into a pack. Fails on patterns without a literal byte to anchor on, and on entries for the
+    // same built-in pattern that both claim a game.
+    std::optional<std::vector<std::uint8_t>> Build(std::vector<Entry> entries, std::string& error)
+    {
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+        for (std::size_t i = 0, first = 0; i < entries.size(); ++i)
+        {
+            if (entries[i].key != entries[first].key)
+                first = i;
+            for (std::size_t j = first; j < i; ++j)
+            {
+                if (entries[i].games & entries[j].games)
+                {
+                    error = "two entries for the same built-in pattern apply to the same game";
+                    return std::nullopt;
+                }
+            }
+        }
+
+        std::vector<PatternRecord> records;
+        std::vector<std::uint8_t> blob;
+        std::vector<std::vector<std::uint32_t>> buckets(kBucketCount);
+
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const auto& entry = entries[i];
+            if (entry.pattern.values.size() > 0xFFFF)
+            {
+                error = "pattern is too long";
+                return std::nullopt;
+            }
+
+            // Absent entries only need their record, there's nothing to match.
+            if (entry.pattern.values.empty())
+            {
+                records.push_back({ entry.key, entry.games, 0, static_cast<std::uint32_t>(blob.size()), 0, 0 });
+                continue;
+            }
+
+            auto anchor = ChooseAnchor(entry.pattern);
+            if (!anchor)
+            {
+                error = "pattern has no literal byte to anchor on before its last byte";
+                return std::nullopt;
+            }
+
+            PatternRecord record{};
+            record.key = entry.key;
+            record.games = entry.games;
+            record.offset = entry.offset;
+            record.bytes = static_cast<std::uint32_t>(blob.size());
+            record.length = static_cast<std::uint16_t>(entry.pattern.values.size());
+            record.anchor = anchor->offset;
+            records.push_back(record);
+
+            blob.insert(blob.end(), entry.pattern.values.begin(), entry.pattern.values.end());
+            blob.insert(blob.end(), entry.pattern.masks.begin(), entry.pattern.masks.end());
+
+            std::uint8_t first = entry.pattern.values[anchor->offset];
+            if (anchor->pair)
+            {
+                buckets[first | (entry.pattern.values[anchor->offset + 1] << 8)].push_back(static_cast<std::uint32_t>(i));
+            }
+            else
+            {
+                for (std::uint32_t second = 0; second < 256; ++second)
+                    buckets[first | (second << 8)].push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+
+        Header header{};
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.patternCount = static_cast<std::uint32_t>(records.size());
+        header.patternsOffset = sizeof(Header);
+        header.bytesOffset = header.patternsOffset + static_cast<std::uint32_t>(records.size() * sizeof(PatternRecord));
+        header.bytesSize = static_cast<std::uint32_t>(blob.size());
+        header.bucketsOffset = (header.bytesOffset + header.bytesSize + 3) & ~3u;
+        header.entriesOffset = header.bucketsOffset + (kBucketCount + 1) * sizeof(std::uint32_t);
+        header.entryCount = 0;
+        for (const auto& bucket : buckets)
+            header.entryCount += static_cast<std::uint32_t>(bucket.size());
+        header.fileSize = header.entriesOffset + header.entryCount * sizeof(std::uint32_t);
+
+        std::vector<std::uint8_t> out;
+        out.reserve(header.fileSize);
+        Append(out, header);
+        for (const auto& record : records)
+            Append(out, record);
+        out.insert(out.end(), blob.begin(), blob.end());
+        out.resize(header.bucketsOffset, 0);
+
+        std::uint32_t first = 0;
+        for (const auto& bucket : buckets)
+        {
+            Append(out, first);
+            first += static_cast<std::uint32_t>(bucket.size());
+        }
+        Append(out, first);
+
+        for (const auto& bucket : buckets)
+            for (std::uint32_t index : bucket)
+                Append(out, index);
+
+        header.checksum = Fnv1a32(out.data() + sizeof(Header), out.size() - sizeof(Header));
+        std::memcpy(out.data(), &header, sizeof(header));
+        return out;
+    }
+
+    // Read-only view over a pack in memory. Everything is used in place, nothing is copied or rebuilt.
+    class View
+    {
+    public:
+        // Validates the header, bounds and checksum. Returns nothing and sets error if the pack can't be used.
+        static std::optional<View> Open(const std::uint8_t* data, std::size_t size, std::string& error)
+        {
+            if (size < sizeof(Header))
+            {
+                error = "file is too small";
+                return std::nullopt;
+            }
+
+            Header header;
+            std::memcpy(&header, data, sizeof(header));
+            if (header.magic != kMagic)
+            {
+                error = "not a signature pack";
+                return std::nullopt;
+            }
+            if (header.version != kVersion)
+            {
+                error = "unsupported pack version " + std::to_string(header.version);
+                return std::nullopt;
+            }
+
+            auto fits = [size](std::uint64_t offset, std::uint64_t bytes) { return offset + bytes <= size; };
+            if (header.fileSize != size ||
+                !fits(header.patternsOffset, std::uint64_t(header.patternCount) * sizeof(PatternRecord)) ||
+                !fits(header.bytesOffset, header.bytesSize) ||
+                !fits(header.bucketsOffset, (std::uint64_t(kBucketCount) + 1) * sizeof(std::uint32_t)) ||
+                !fits(header.entriesOffset, std::uint64_t(header.entryCount) * sizeof(std::uint32_t)) ||
+                (header.patternsOffset | header.bucketsOffset | header.entriesOffset) % 4 != 0)
+            {
+                error = "truncated or malformed pack";
+                return std::nullopt;
+            }
+
+            if (Fnv1a32(data + sizeof(Header), size - sizeof(Header)) != header.checksum)
+            {
+                error = "checksum mismatch";
+                return std::nullopt;
+            }
+
+            View view;
+            view.m_data = data;
+            view.m_header = header;
+            view.m_records = reinterpret_cast<const PatternRecord*>(data + header.patternsOffset);
+            view.m_buckets = reinterpret_cast<const std::uint32_t*>(data + header.bucketsOffset);
+            view.m_entries = reinterpret_cast<const std::uint32_t*>(data + header.entriesOffset);
+
+            for (std::uint32_t i = 0; i < header.patternCount; ++i)
+            {
+                const auto& record = view.m_records[i];
+                bool absent = Absent(record) && record.anchor == 0 && record.offset == 0;
+                if ((!absent && (record.length < 2 || record.anchor + 1u >= record.length)) || std::uint64_t(record.bytes) + record.length * 2ull > header.bytesSize)
+                {
+                    error = "malformed pattern record";
+                    return std::nullopt;
+                }
+                view.m_maxAnchor = std::max<std::size_t>(view.m_maxAnchor, record.anchor);
+            }
+            for (std::uint32_t i = 0; i < header.entryCount; ++i)
+            {
+                if (view.m_entries[i] >= header.patternCount)
+                {
+                    error = "malformed anchor table";
+                    return std::nullopt;
+                }
+            }
+            bool bucketsSorted = view.m_buckets[0] == 0;
+            for (std::uint32_t i = 0; i < kBucketCount && bucketsSorted; ++i)
+                bucketsSorted = view.m_buckets[i] <= view.m_buckets[i + 1];
+            if (!bucketsSorted || view.m_buckets[kBucketCount] != header.entryCount)
+            {
+                error = "malformed anchor table";
+                return std::nullopt;
+            }
+            return view;
+        }
+
+        std::uint32_t PatternCount() const { return m_header.patternCount; }
+        const PatternRecord& Record(std::uint32_t index) const { return m_records[index]; }
+        const std::uint8_t* Values(const PatternRecord& record) const { return m_data + m_header.bytesOffset + record.bytes; }
+        const std::uint8_t* Masks(const PatternRecord& record) const { return Values(record) + record.length; }
+
+        bool Contains(std::uint64_t key) const
+        {
+            auto* end = m_records + m_header.patternCount;
+            auto* it = std::lower_bound(m_records, end, key, [](const PatternRecord& record, std::uint64_t k) { return record.key < k; });
+            return it != end && it->key == key;
+        }
+
+        // Index of the entry standing in for the built-in pattern with this key, if one applies to game.
+        std::optional<std::uint32_t> Find(std::uint64_t key, int game) const
+        {
+            auto* end = m_records + m_header.patternCount;
+            auto* it = std::lower_bound(m_records, end, key, [](const PatternRecord& record, std::uint64_t k) { return record.key < k; });
+            for (; it != end && it->key == key; ++it)
+            {
+                if (AppliesTo(*it, game))
+                    return static_cast<std::uint32_t>(it - m_records);
+            }
+            return std::nullopt;
+        }
+
+        // The builder's marker for a built-in pattern known to have no match in the entry's games. Only these are
+        // allowed to stop a scan, a key that's merely missing for a game says nothing.
+        static bool Absent(const PatternRecord& record)
+        {
+            return record.length == 0;
+        }
+
+        static bool AppliesTo(const PatternRecord& record, int game)
+        {
+            return game >= 0 && game < 32 && (record.games & (1u << game)) != 0;
+        }
+
+        // Calls onMatch(index, start) for every pattern applying to game that starts in [begin, end).
+        // Matches may read up to limit.
+        template <typename Callback>
+        void Match(const std::uint8_t* begin, const std::uint8_t* end, const std::uint8_t* limit, int game, Callback&& onMatch) const
+        {
+            if (limit - begin < 2 || end <= begin)
+                return;
+
+            // Nothing starting in [begin, end) can have its anchor past end + m_maxAnchor.
+            const std::uint8_t* last = static_cast<std::size_t>(limit - end) > m_maxAnchor + 1 ? end + m_maxAnchor + 1 : limit;
+            for (const std::uint8_t* p = begin; p + 1 < last; ++p)
+            {
+                std::uint16_t bucket = static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+                for (std::uint32_t e = m_buckets[bucket]; e < m_buckets[bucket + 1]; ++e)
+                {
+                    std::uint32_t index = m_entries[e];
+                    const auto& record = m_records[index];
+                    if (static_cast<std::size_t>(p - begin) < record.anchor)
+                        continue;
+
+                    const std::uint8_t* start = p - record.anchor;
+                    if (start >= end || static_cast<std::size_t>(limit - start) < record.length || !AppliesTo(record, game))
+                        continue;
+
+                    const std::uint8_t* values = Values(record);
+                    const std::uint8_t* masks = Masks(record);
+                    bool matched = true;
+                    for (std::uint16_t j = 0; j < record.length && matched; ++j)
+                        matched = (start[j] & masks[j]) == values[j];
+                    if (matched)
+                        onMatch(index, start);
+                }
+            }
+        }
+
+    private:
+        const std::uint8_t* m_data = nullptr;
+        Header m_header{};
+        const PatternRecord* m_records = nullptr;
+        const std::uint32_t* m_buckets = nullptr;
+        const std::uint32_t* m_entries = nullptr;
+        std::size_t m_maxAnchor = 0;
+    };
+}
@@ -3,7 +3,22 @@
 #define WIN32_LEAN_AND_MEAN
 
 #include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <fstream>
 #include <filesystem>
-#include <vector>
\ No newline at end of file
+#include <format>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
@@ -0,0 +1,218 @@
+// Tests for BlockCache against a local stand-in for the game's archive reader.
+//
+//   BlockCacheTest    Exits with 0 when every check passes.
+
+#include "../../src/blockcache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+    void Check(bool condition, const char* expression, int line)
+    {
+        if (!condition)
+        {
+            std::cerr << "blockcache/main.cpp:" << line << ": check failed: " << expression << "\n";
+            failures++;
+        }
+    }
+
+#define CHECK(expression) Check((expression), #expression, __LINE__)
+
+    // Stand-in file reader: positioned reads from a file on disk, like HandleSource does with a second handle.
+    class FileSource : public BlockCache::Source
+    {
+    public:
+        explicit FileSource(const std::filesystem::path& path) : m_file(path, std::ios::binary) {}
+
+        std::int64_t Read(std::uint64_t offset, void* buffer, std::size_t size) override
+        {
+            std::lock_guard lock(m_mutex);
+            reads++;
+            if (!m_file)
+                return -1;
+
+            m_file.clear();
+            m_file.seekg(static_cast<std::streamoff>(offset));
+            m_file.read(static_cast<char*>(buffer), static_cast<std::streamsize>(size));
+            return m_file.gcount();
+        }
+
+        std::atomic<unsigned int> reads{ 0 };
+
+    private:
+        std::mutex m_mutex;
+        std::ifstream m_file;
+    };
+
+    class FailingSource : public BlockCache::Source
+    {
+    public:
+        std::int64_t Read(std::uint64_t, void*, std::size_t) override { return -1; }
+    };
+
+    std::uint8_t ByteAt(std::uint64_t offset)
+    {
+        return static_cast<std::uint8_t>((offset * 131) ^ (offset >> 9));
+    }
+
+    std::filesystem::path WriteArchive(std::size_t size)
+    {
+        auto path = std::filesystem::temp_directory_path() / "DragonTweak_BlockCacheTest.par";
+        std::ofstream file(path, std::ios::binary);
+        for (std::size_t offset = 0; offset < size; ++offset)
+            file.put(static_cast<char>(ByteAt(offset)));
+        return path;
+    }
+
+    bool Matches(const std::vector<std::uint8_t>& buffer, std::uint64_t offset, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (buffer[i] != ByteAt(offset + i))
+                return false;
+        }
+        return true;
+    }
+
+    // Prefetching happens on the cache's worker, wait for it to settle.
+    bool WaitForBlocks(BlockCache::Cache& cache, std::uint64_t blocks)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            auto stats = cache.GetStats();
+            if (stats.blocksPrefetched + stats.prefetchFailures >= blocks)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    void TestAccessPattern()
+    {
+        BlockCache::Config config{ 4096, 64 * 4096, 4 };
+
+        BlockCache::AccessPattern sequential;
+        CHECK(sequential.Observe(0, 100, config).empty());
+        CHECK(sequential.Observe(100, 100, config).empty());
+        auto predictions = sequential.Observe(200, 100, config);
+        CHECK(predictions.size() == 1 && predictions[0].offset == 300 && predictions[0].size == 4 * 4096);
+
+        BlockCache::AccessPattern strided;
+        strided.Observe(0, 64, config);
+        strided.Observe(1000, 64, config);
+        strided.Observe(2000, 64, config);
+        predictions = strided.Observe(3000, 64, config);
+        CHECK(predictions.size() == 4 && predictions[0].offset == 4000 && predictions[3].offset == 7000 && predictions[3].size == 64);
+
+        BlockCache::AccessPattern random;
+        random.Observe(5000, 64, config);
+        random.Observe(100, 64, config);
+        random.Observe(9000, 64, config);
+        CHECK(random.Observe(300, 64, config).empty());
+
+        // Strides that would run below the start of the file stop early.
+        BlockCache::AccessPattern backwards;
+        backwards.Observe(3000, 64, config);
+        backwards.Observe(2000, 64, config);
+        backwards.Observe(1000, 64, config);
+        predictions = backwards.Observe(0, 64, config);
+        CHECK(predictions.empty());
+    }
+
+    void TestReads(const std::filesystem::path& path, std::size_t fileSize)
+    {
+        BlockCache::Config config{ 4096, 64 * 4096, 4 };
+        BlockCache::Cache cache(config);
+        auto source = std::make_shared<FileSource>(path);
+        auto file = cache.AddFile(source);
+
+        std::vector<std::uint8_t> buffer(3 * 4096);
+        CHECK(!cache.Read(file, 0, buffer.data(), 100));
+        CHECK(cache.GetStats().misses == 1);
+
+        // Every block, including the short one at the end of the file.
+        cache.Prefetch(file, 0, fileSize);
+        std::uint64_t blocks = (fileSize + config.blockSize - 1) / config.blockSize;
+        CHECK(WaitForBlocks(cache, blocks));
+        CHECK(cache.GetStats().blocksPrefetched == blocks);
+
+        // Straddles two blocks.
+        auto read = cache.Read(file, 4000, buffer.data(), 200);
+        CHECK(read && *read == 200 && Matches(buffer, 4000, 200));
+
+        // Runs past the end of the file and comes back short.
+        read = cache.Read(file, fileSize - 50, buffer.data(), 4096);
+        CHECK(read && *read == 50 && Matches(buffer, fileSize - 50, 50));
+
+        // Resident blocks aren't read again.
+        unsigned int sourceReads = source->reads;
+        cache.Prefetch(file, 0, fileSize);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(source->reads == sourceReads);
+
+        auto stats = cache.GetStats();
+        CHECK(stats.hits == 2 && stats.bytesServed == 250);
+    }
+
+    void TestBudget(const std::filesystem::path& path)
+    {
+        BlockCache::Config config{ 4096, 2 * 4096, 4 };
+        BlockCache::Cache cache(config);
+        auto file = cache.AddFile(std::make_shared<FileSource>(path));
+
+        cache.Prefetch(file, 0, 4 * 4096);
+        CHECK(WaitForBlocks(cache, 4));
+
+        // Oldest blocks go first, the newest stay resident.
+        std::vector<std::uint8_t> buffer(4096);
+        CHECK(cache.GetStats().blocksEvicted == 2);
+        CHECK(!cache.Read(file, 0, buffer.data(), 4096));
+        auto read = cache.Read(file, 3 * 4096, buffer.data(), 4096);
+        CHECK(read && *read == 4096 && Matches(buffer, 3 * 4096, 4096));
+    }
+
+    void TestFailures()
+    {
+        BlockCache::Config config{ 4096, 64 * 4096, 4 };
+        BlockCache::Cache cache(config);
+        auto file = cache.AddFile(std::make_shared<FailingSource>());
+
+        cache.Prefetch(file, 0, 2 * 4096);
+        CHECK(WaitForBlocks(cache, 2));
+        CHECK(cache.GetStats().prefetchFailures == 2);
+
+        std::vector<std::uint8_t> buffer(16);
+        CHECK(!cache.Read(file, 0, buffer.data(), buffer.size()));
+    }
+}
+
+int main()
+{
+    constexpr std::size_t kFileSize = 10 * 4096 + 1234;
+    auto path = WriteArchive(kFileSize);
+
+    TestAccessPattern();
+    TestReads(path, kFileSize);
+    TestBudget(path);
+    TestFailures();
+
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    if (failures)
+    {
+        std::cerr << failures << " check(s) failed.\n";
+        return 1;
+    }
+    std::cout << "All BlockCache checks passed.\n";
+    return 0;
+}
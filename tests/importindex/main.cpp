@@ -0,0 +1,216 @@
+// Tests for ImportIndex against real PE32/PE32+ files and a synthetic delay-load image.
+//
+//   ImportIndexTest <pe files...>    Exits with 0 when every check passes.
+//
+// Any Windows executables will do, on Linux the launchers pip ships in pip/_vendor/distlib (w32.exe, w64.exe, ...)
+// cover both PE32 and PE32+. On Windows the test checks itself and notepad.exe when no files are given.
+
+#include "../../src/importindex.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+    int failures = 0;
+
+    void Check(bool condition, const char* expression, int line)
+    {
+        if (!condition)
+        {
+            std::cerr << "importindex/main.cpp:" << line << ": check failed: " << expression << "\n";
+            failures++;
+        }
+    }
+
+#define CHECK(expression) Check((expression), #expression, __LINE__)
+
+    template <typename T>
+    T Read(const std::vector<std::uint8_t>& image, std::size_t offset)
+    {
+        T value{};
+        if (offset + sizeof(T) <= image.size())
+            std::memcpy(&value, image.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void Write(std::vector<std::uint8_t>& image, std::size_t offset, T value)
+    {
+        std::memcpy(image.data() + offset, &value, sizeof(T));
+    }
+
+    // Lays a file out the way the loader maps it, so both layouts can be checked against each other.
+    std::vector<std::uint8_t> MapImage(const std::vector<std::uint8_t>& file)
+    {
+        std::size_t nt = Read<std::uint32_t>(file, 0x3C);
+        std::size_t optional = nt + 24;
+        std::uint16_t sectionCount = Read<std::uint16_t>(file, nt + 6);
+        std::size_t sections = optional + Read<std::uint16_t>(file, nt + 20);
+
+        std::vector<std::uint8_t> image(Read<std::uint32_t>(file, optional + 56));
+        std::size_t headers = std::min<std::size_t>({ Read<std::uint32_t>(file, optional + 60), file.size(), image.size() });
+        std::copy(file.begin(), file.begin() + headers, image.begin());
+
+        for (std::uint16_t i = 0; i < sectionCount; ++i)
+        {
+            std::size_t section = sections + i * 40;
+            std::size_t virtualAddress = Read<std::uint32_t>(file, section + 12);
+            std::size_t rawSize = Read<std::uint32_t>(file, section + 16);
+            std::size_t rawPointer = Read<std::uint32_t>(file, section + 20);
+            if (rawPointer >= file.size() || virtualAddress >= image.size())
+                continue;
+
+            std::size_t count = std::min({ rawSize, file.size() - rawPointer, image.size() - virtualAddress });
+            std::copy(file.begin() + rawPointer, file.begin() + rawPointer + count, image.begin() + virtualAddress);
+        }
+        return image;
+    }
+
+    bool SameImports(const ImportIndex::Index& a, const ImportIndex::Index& b)
+    {
+        const auto& left = a.Imports();
+        const auto& right = b.Imports();
+        if (left.size() != right.size())
+            return false;
+
+        for (std::size_t i = 0; i < left.size(); ++i)
+        {
+            if (left[i].module != right[i].module || left[i].name != right[i].name || left[i].ordinal != right[i].ordinal ||
+                left[i].slot != right[i].slot || left[i].delayLoad != right[i].delayLoad)
+                return false;
+        }
+        return true;
+    }
+
+    void TestFile(const std::string& path)
+    {
+        std::ifstream input(path, std::ios::binary);
+        std::vector<std::uint8_t> file((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        if (file.empty())
+        {
+            std::cerr << path << ": failed to read\n";
+            failures++;
+            return;
+        }
+
+        std::string error;
+        auto index = ImportIndex::Index::Parse(file.data(), file.size(), ImportIndex::Layout::File, error);
+        if (!index)
+        {
+            std::cerr << path << ": " << error << "\n";
+            failures++;
+            return;
+        }
+
+        std::size_t nt = Read<std::uint32_t>(file, 0x3C);
+        bool is64 = Read<std::uint16_t>(file, nt + 24) == 0x20B;
+        std::uint32_t sizeOfImage = Read<std::uint32_t>(file, nt + 24 + 56);
+        std::cout << path << ": " << (is64 ? "PE32+" : "PE32") << ", " << index->Imports().size() << " import(s)\n";
+
+        CHECK(index->SlotSize() == (is64 ? 8u : 4u));
+        CHECK(index->ImageBase() == (is64 ? Read<std::uint64_t>(file, nt + 24 + 24) : Read<std::uint32_t>(file, nt + 24 + 28)));
+        CHECK(!index->Imports().empty());
+
+        for (const auto& import : index->Imports())
+        {
+            CHECK(!import.module.empty());
+            CHECK(std::none_of(import.module.begin(), import.module.end(), [](char c) { return std::isupper(static_cast<unsigned char>(c)); }));
+            CHECK(import.slot % index->SlotSize() == 0 && import.slot + index->SlotSize() <= sizeOfImage);
+
+            // Lookups are case insensitive on the module and find the first listing of a function.
+            std::string upper = import.module;
+            std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+            const auto* found = import.name.empty() ? index->Find(upper, import.ordinal) : index->Find(upper, import.name);
+            CHECK(found && found->module == import.module && found->name == import.name);
+        }
+
+        // Before binding, the mapped image's IAT still holds the name table, so both layouts agree.
+        auto mapped = MapImage(file);
+        auto mappedIndex = ImportIndex::Index::Parse(mapped.data(), mapped.size(), ImportIndex::Layout::Mapped, error);
+        CHECK(mappedIndex && SameImports(*index, *mappedIndex));
+
+        // Cut short anywhere, the parser reports an error or a subset, never reads past the end.
+        for (std::size_t size = 0; size < file.size(); size += file.size() / 997 + 1)
+        {
+            std::vector<std::uint8_t> truncated(file.begin(), file.begin() + size);
+            ImportIndex::Index::Parse(truncated.data(), truncated.size(), ImportIndex::Layout::File, error);
+        }
+    }
+
+    // A mapped PE32+ with one delay-load descriptor for DBGHELP.dll, by name and by ordinal.
+    void TestDelayLoad()
+    {
+        std::vector<std::uint8_t> image(0x2000);
+        const std::size_t nt = 0x80, optional = nt + 24;
+        Write<std::uint16_t>(image, 0, 0x5A4D);
+        Write<std::uint32_t>(image, 0x3C, nt);
+        Write<std::uint32_t>(image, nt, 0x4550);
+        Write<std::uint16_t>(image, nt + 20, 240);
+        Write<std::uint16_t>(image, optional, 0x20B);
+        Write<std::uint64_t>(image, optional + 24, 0x140000000);
+        Write<std::uint32_t>(image, optional + 56, 0x2000);
+        Write<std::uint32_t>(image, optional + 60, 0x400);
+        Write<std::uint32_t>(image, optional + 108, 16);
+        Write<std::uint32_t>(image, optional + 112 + 13 * 8, 0x1000);
+
+        Write<std::uint32_t>(image, 0x1000, 1);         // RVA based
+        Write<std::uint32_t>(image, 0x1004, 0x1100);    // Name
+        Write<std::uint32_t>(image, 0x100C, 0x1200);    // IAT
+        Write<std::uint32_t>(image, 0x1010, 0x1300);    // Name table
+        std::memcpy(image.data() + 0x1100, "DBGHELP.dll", 12);
+        Write<std::uint64_t>(image, 0x1300, 0x1400);
+        Write<std::uint64_t>(image, 0x1308, 0x8000000000000007ull);
+        Write<std::uint16_t>(image, 0x1400, 5);
+        std::memcpy(image.data() + 0x1402, "MiniDumpWriteDump", 18);
+
+        std::string error;
+        auto index = ImportIndex::Index::Parse(image.data(), image.size(), ImportIndex::Layout::Mapped, error);
+        CHECK(index.has_value());
+        if (!index)
+            return;
+
+        const auto* byName = index->Find("dbghelp.DLL", "MiniDumpWriteDump");
+        const auto* byOrdinal = index->Find("dbghelp.dll", std::uint16_t(7));
+        CHECK(index->Imports().size() == 2);
+        CHECK(byName && byName->slot == 0x1200 && byName->delayLoad && byName->ordinal == 5);
+        CHECK(byOrdinal && byOrdinal->slot == 0x1208 && byOrdinal->delayLoad && byOrdinal->name.empty());
+        CHECK(!index->Find("dbghelp.dll", "MiniDumpReadDumpStream"));
+
+        // A descriptor pointing off the image is an error, not a crash.
+        Write<std::uint32_t>(image, 0x1010, 0x1FFC);
+        CHECK(!ImportIndex::Index::Parse(image.data(), image.size(), ImportIndex::Layout::Mapped, error));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> files(argv + 1, argv + argc);
+#ifdef _WIN32
+    if (files.empty())
+    {
+        files.push_back(argv[0]);
+        if (const char* systemRoot = std::getenv("SystemRoot"))
+            files.push_back(std::string(systemRoot) + "\\System32\\notepad.exe");
+    }
+#endif
+    if (files.empty())
+        std::cerr << "No PE files given, only the synthetic image is checked.\n";
+
+    TestDelayLoad();
+    for (const auto& file : files)
+        TestFile(file);
+
+    if (failures)
+    {
+        std::cerr << failures << " check(s) failed.\n";
+        return 1;
+    }
+    std::cout << "All ImportIndex checks passed.\n";
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Builds DragonTweak.sigpack from a signature source list.
+//
+//   SigPack <source.txt> <output.sigpack>   Compile a source list into a pack.
+//   SigPack --dump <pack.sigpack>           Validate a pack and list its entries.
+//
+// Each source line is "games | built-in pattern | pattern | offset":
+//   games             Comma separated game names from SigPack::kGameNames, or * for every game.
+//   built-in pattern  The signature exactly as DragonTweak scans for it, this is what the entry replaces.
+//   pattern           Pattern to scan for instead, leave empty to reuse the built-in one. A single - marks the
+//                     built-in pattern as absent from these games' builds, so DragonTweak skips scanning for it.
+//   offset            Added to every match of pattern, leave empty for 0.
+// Blank lines and lines starting with # are ignored.
+
+#include "../../src/sigpack.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace
+{
+    std::string Trim(std::string_view text)
+    {
+        auto first = text.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos)
+            return {};
+        auto last = text.find_last_not_of(" \t\r");
+        return std::string(text.substr(first, last - first + 1));
+    }
+
+    std::vector<std::string> Split(const std::string& text, char separator)
+    {
+        std::vector<std::string> fields;
+        std::stringstream stream(text);
+        std::string field;
+        while (std::getline(stream, field, separator))
+            fields.push_back(Trim(field));
+        if (!text.empty() && text.back() == separator)
+            fields.emplace_back();
+        return fields;
+    }
+
+    std::optional<std::uint32_t> ParseGames(const std::string& text)
+    {
+        if (text == "*")
+            return SigPack::kAllGames;
+
+        std::uint32_t games = 0;
+        for (const auto& name : Split(text, ','))
+        {
+            auto it = std::find_if(SigPack::kGameNames.begin(), SigPack::kGameNames.end(), [&](const char* gameName) { return name == gameName; });
+            if (it == SigPack::kGameNames.end())
+                return std::nullopt;
+            games |= 1u << (it - SigPack::kGameNames.begin());
+        }
+        return games ? std::optional(games) : std::nullopt;
+    }
+
+    std::string GameList(std::uint32_t games)
+    {
+        if (games == SigPack::kAllGames)
+            return "*";
+
+        std::string list;
+        for (std::size_t i = 0; i < SigPack::kGameNames.size(); ++i)
+        {
+            if (games & (1u << i))
+                list += (list.empty() ? "" : ",") + std::string(SigPack::kGameNames[i]);
+        }
+        return list;
+    }
+
+    int Compile(const char* sourcePath, const char* outputPath)
+    {
+        std::ifstream source(sourcePath);
+        if (!source)
+        {
+            std::cerr << "Failed to open " << sourcePath << "\n";
+            return 1;
+        }
+
+        std::vector<SigPack::Entry> entries;
+        std::string line;
+        for (int lineNumber = 1; std::getline(source, line); ++lineNumber)
+        {
+            line = Trim(line);
+            if (line.empty() || line.front() == '#')
+                continue;
+
+            auto fail = [&](const std::string& reason)
+            {
+                std::cerr << sourcePath << ":" << lineNumber << ": " << reason << "\n";
+                return 1;
+            };
+
+            auto fields = Split(line, '|');
+            if (fields.size() < 2 || fields.size() > 4)
+                return fail("expected \"games | built-in pattern | pattern | offset\"");
+
+            auto games = ParseGames(fields[0]);
+            if (!games)
+                return fail("unknown game list \"" + fields[0] + "\"");
+
+            auto key = SigPack::Key(fields[1]);
+            if (!key)
+                return fail("invalid built-in pattern");
+
+            if (fields.size() > 2 && fields[2] == "-")
+            {
+                if (fields.size() > 3 && !fields[3].empty())
+                    return fail("an absent entry can't have an offset");
+                entries.push_back({ *key, *games, 0, {} });
+                continue;
+            }
+
+            auto pattern = SigPack::Parse(fields.size() > 2 && !fields[2].empty() ? fields[2] : fields[1]);
+            if (!pattern)
+                return fail("invalid pattern");
+
+            std::int32_t offset = 0;
+            if (fields.size() > 3 && !fields[3].empty())
+            {
+                try
+                {
+                    offset = static_cast<std::int32_t>(std::stol(fields[3], nullptr, 0));
+                }
+                catch (const std::exception&)
+                {
+                    return fail("invalid offset \"" + fields[3] + "\"");
+                }
+            }
+
+            entries.push_back({ *key, *games, offset, std::move(*pattern) });
+        }
+
+        std::string error;
+        auto pack = SigPack::Build(std::move(entries), error);
+        if (!pack)
+        {
+            std::cerr << "Failed to build pack: " << error << "\n";
+            return 1;
+        }
+
+        std::ofstream output(outputPath, std::ios::binary);
+        output.write(reinterpret_cast<const char*>(pack->data()), static_cast<std::streamsize>(pack->size()));
+        if (!output)
+        {
+            std::cerr << "Failed to write " << outputPath << "\n";
+            return 1;
+        }
+
+        std::cout << "Wrote " << outputPath << " (" << pack->size() << " bytes).\n";
+        return 0;
+    }
+
+    int Dump(const char* packPath)
+    {
+        std::ifstream input(packPath, std::ios::binary);
+        std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        std::string error;
+        auto view = SigPack::View::Open(data.data(), data.size(), error);
+        if (!view)
+        {
+            std::cerr << packPath << ": " << error << "\n";
+            return 1;
+        }
+
+        for (std::uint32_t i = 0; i < view->PatternCount(); ++i)
+        {
+            const auto& record = view->Record(i);
+            const auto* values = view->Values(record);
+            const auto* masks = view->Masks(record);
+
+            std::string pattern = SigPack::View::Absent(record) ? "-" : "";
+            for (std::uint16_t j = 0; j < record.length; ++j)
+            {
+                char byte[4];
+                std::snprintf(byte, sizeof(byte), masks[j] ? "%02X" : "??", values[j]);
+                pattern += (j ? " " : "") + std::string(byte);
+            }
+
+            std::printf("%016llx | %s | %s | %d (anchor %u)\n", static_cast<unsigned long long>(record.key), GameList(record.games).c_str(), pattern.c_str(), record.offset, record.anchor);
+        }
+        std::cout << view->PatternCount() << " pattern(s).\n";
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && std::string_view(argv[1]) == "--dump")
+        return Dump(argv[2]);
+    if (argc == 3)
+        return Compile(argv[1], argv[2]);
+
+    std::cerr << "Usage: SigPack <source.txt> <output.sigpack>\n       SigPack --dump <pack.sigpack>\n";
+    return 2;
+}
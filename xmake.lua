@@ -6,7 +6,7 @@ set_optimize("faster")
   target("DragonTweak")
     set_kind("shared")
     add_files("src/**.cpp", "external/safetyhook/safetyhook.cpp", "external/safetyhook/Zydis.c")
-    add_syslinks("user32")
+    add_syslinks("user32", "d3d11")
     add_includedirs("external/spdlog/include", "external/inipp", "external/safetyhook")
     set_prefixname("")
     set_extension(".asi")
@@ -21,3 +21,36 @@ set_optimize("faster")
       add_cxflags("/MTd")
     end
   end
+
+  -- Offline signature pack builder: xmake build SigPack && xmake run SigPack tools/sigpack/signatures.txt DragonTweak.sigpack
+  target("SigPack")
+    set_kind("binary")
+    set_default(false)
+    set_rundir("$(projectdir)")
+    add_files("tools/sigpack/main.cpp")
+    if is_plat("windows") then
+      set_toolchains("msvc")
+      add_cxflags("/utf-8")
+    end
+
+  -- BlockCache tests against a stand-in file reader, runs anywhere: xmake build BlockCacheTest && xmake run BlockCacheTest
+  target("BlockCacheTest")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/blockcache/main.cpp")
+    if is_plat("windows") then
+      set_toolchains("msvc")
+      add_cxflags("/utf-8")
+    else
+      add_syslinks("pthread")
+    end
+
+  -- ImportIndex tests against real PE files, runs anywhere: xmake build ImportIndexTest && xmake run ImportIndexTest <pe files...>
+  target("ImportIndexTest")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/importindex/main.cpp")
+    if is_plat("windows") then
+      set_toolchains("msvc")
+      add_cxflags("/utf-8")
+    end